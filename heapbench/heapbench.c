@@ -0,0 +1,298 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "heapbench.h"
+
+/*** Benchmark for the kernel heap (student-distrib/kheap.c), which is compiled into this program
+ *** and run on a region of memory mapped by hosted.c. It replays traces of calls to kmalloc,
+ *** krealloc and kfree, either recorded by a kernel built with KHEAP_TRACE_ENABLE or generated from one of the
+ *** synthetic workloads, and reports the cost of each call and the fragmentation of the heap ***/
+
+// The default number of steps taken by a synthetic workload
+#define DEFAULT_ITERATIONS 100000
+// The default number of calls between samples of the heap statistics
+#define DEFAULT_SAMPLE_INTERVAL 10000
+// The seed used for the workloads, so that every run generates the same trace
+#define WORKLOAD_SEED 391
+
+/*
+ * Adds a record to the end of the trace, doubling the capacity when it is full
+ */
+void trace_append(trace_t *trace, char op, uint32_t size, uint32_t alignment, uint32_t ptr) {
+	if (trace->length == trace->capacity) {
+		trace->capacity = (trace->capacity == 0) ? 1024 : 2 * trace->capacity;
+		trace->records = realloc(trace->records, trace->capacity * sizeof(trace_record));
+		if (trace->records == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+
+	trace_record *record = &trace->records[trace->length++];
+	record->op = op;
+	record->size = size;
+	record->alignment = alignment;
+	record->ptr = ptr;
+	record->match = -1;
+}
+
+/*
+ * Reads a trace in the format of the kernel's HEAP_TRACE_FILENAME file
+ *
+ * INPUTS: file: the file to read from
+ *         trace: an empty trace to fill in
+ * OUTPUTS: 0 on success and -1 if a line could not be parsed
+ */
+int load_trace(FILE *file, trace_t *trace) {
+	char op;
+	uint32_t size, alignment, ptr;
+	int num_read;
+
+	while ((num_read = fscanf(file, " %c %x %x %x", &op, &size, &alignment, &ptr)) == 4) {
+		if (op != HEAP_TRACE_ALLOC && op != HEAP_TRACE_REALLOC && op != HEAP_TRACE_FREE)
+			return -1;
+
+		trace_append(trace, op, size, alignment, ptr);
+	}
+
+	return (num_read == EOF) ? 0 : -1;
+}
+
+/*
+ * Writes a trace in the format of the kernel's HEAP_TRACE_FILENAME file
+ */
+void write_trace(FILE *file, const trace_t *trace) {
+	uint32_t i;
+	for (i = 0; i < trace->length; i++) {
+		const trace_record *record = &trace->records[i];
+		fprintf(file, "%c %08x %08x %08x\n", record->op, record->size, record->alignment, record->ptr);
+	}
+}
+
+/*
+ * Fills in the match field of every free and krealloc with the index of the allocation that
+ *  returned the pointer passed in, using an open addressing hash table keyed by pointer
+ * The kernel reuses addresses, so a pointer is removed from the table once it is freed
+ */
+static void match_trace(trace_t *trace) {
+	// Every allocation uses at most one new slot, so the table can never fill up
+	uint32_t table_size = 1;
+	while (table_size < 2 * trace->length)
+		table_size <<= 1;
+
+	// Each slot holds 1 + the index of an allocation, 0 if it was never used,
+	//  or -1 if the allocation in it was freed
+	int32_t *table = calloc(table_size, sizeof(int32_t));
+	if (table == NULL) {
+		perror("calloc");
+		exit(1);
+	}
+
+	uint32_t i;
+	for (i = 0; i < trace->length; i++) {
+		trace_record *record = &trace->records[i];
+
+		// krealloc frees the pointer passed in (if it succeeded) and allocates the one returned
+		uint32_t freed_ptr = (record->op == HEAP_TRACE_FREE) ? record->ptr :
+		                     (record->op == HEAP_TRACE_REALLOC && record->ptr != 0) ? record->alignment : 0;
+		uint32_t allocated_ptr = (record->op == HEAP_TRACE_FREE) ? 0 : record->ptr;
+
+		if (freed_ptr != 0) {
+			uint32_t slot = (freed_ptr * 2654435761u) & (table_size - 1);
+			for (; table[slot] != 0; slot = (slot + 1) & (table_size - 1)) {
+				if (table[slot] > 0 && trace->records[table[slot] - 1].ptr == freed_ptr) {
+					record->match = table[slot] - 1;
+					table[slot] = -1;
+					break;
+				}
+			}
+		}
+
+		// Failed allocations cannot be freed later
+		if (allocated_ptr != 0) {
+			uint32_t slot = (allocated_ptr * 2654435761u) & (table_size - 1);
+			while (table[slot] > 0)
+				slot = (slot + 1) & (table_size - 1);
+			table[slot] = i + 1;
+		}
+	}
+
+	free(table);
+}
+
+/*
+ * Returns the current time in nanoseconds
+ */
+static uint64_t get_time_ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*
+ * Comparison function for sorting latencies with qsort
+ */
+static int compare_latencies(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * Prints one line of heap statistics, preceded by the number of calls replayed so far
+ */
+static void print_sample(uint32_t num_calls) {
+	heap_stats_t stats;
+	get_heap_stats(&stats);
+	printf("%10u %12u %12u %12u %6u%%\n", num_calls, stats.bytes_in_use, stats.free_bytes,
+	       stats.largest_free_block, stats.fragmentation);
+}
+
+/*
+ * Replays a trace against a freshly initialized heap, printing the heap statistics every
+ *  sample_interval calls and the latency of the calls at the end
+ *
+ * INPUTS: trace: the trace to replay
+ *         sample_interval: the number of calls between samples of the heap statistics
+ * OUTPUTS: 0 on success and -1 if the heap could not be set up
+ */
+static int replay_trace(trace_t *trace, uint32_t sample_interval) {
+	match_trace(trace);
+
+	if (init_hosted_heap() == -1) {
+		perror("mmap");
+		return -1;
+	}
+
+	// The pointer returned for each allocation in the trace, and the time taken by each call
+	void **ptrs = calloc(trace->length, sizeof(void*));
+	uint64_t *latencies = malloc(trace->length * sizeof(uint64_t));
+	if (ptrs == NULL || latencies == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+
+	uint32_t num_allocations = 0, num_frees = 0, num_failed = 0, worst_call = 0;
+	uint64_t total_ns = 0;
+
+	printf("%10s %12s %12s %12s %7s\n", "calls", "in_use", "free", "largest_free", "frag");
+
+	uint32_t i;
+	for (i = 0; i < trace->length; i++) {
+		trace_record *record = &trace->records[i];
+		uint64_t start = get_time_ns();
+
+		if (record->op == HEAP_TRACE_ALLOC) {
+			ptrs[i] = (record->alignment != 0) ? kmalloc_aligned(record->size, record->alignment)
+			                                   : kmalloc(record->size);
+		} else if (record->op == HEAP_TRACE_REALLOC) {
+			// Resizing a buffer allocated before the trace started is replayed as an allocation
+			void *old_ptr = (record->match >= 0) ? ptrs[record->match] : NULL;
+			ptrs[i] = krealloc(old_ptr, record->size);
+			if (ptrs[i] != NULL && record->match >= 0)
+				ptrs[record->match] = NULL;
+		} else if (record->match >= 0) {
+			kfree(ptrs[record->match]);
+			ptrs[record->match] = NULL;
+		}
+
+		latencies[i] = get_time_ns() - start;
+		total_ns += latencies[i];
+		if (latencies[i] > latencies[worst_call])
+			worst_call = i;
+
+		if (record->op == HEAP_TRACE_FREE) {
+			num_frees++;
+		} else {
+			num_allocations++;
+			if (ptrs[i] == NULL)
+				num_failed++;
+		}
+
+		if ((i + 1) % sample_interval == 0)
+			print_sample(i + 1);
+	}
+	print_sample(trace->length);
+
+	// Anything that was never freed is left allocated, as it was in the kernel
+	verify_no_overlaps();
+
+	if (trace->length > 0) {
+		uint64_t worst_ns = latencies[worst_call];
+		qsort(latencies, trace->length, sizeof(uint64_t), compare_latencies);
+
+		printf("\n%u calls: %u allocations and resizes (%u failed), %u frees\n",
+		       trace->length, num_allocations, num_failed, num_frees);
+		printf("mean %.1f ns/call, median %llu ns, p99 %llu ns, worst %llu ns (call %u, %c %u bytes)\n",
+		       (double)total_ns / trace->length,
+		       (unsigned long long)latencies[trace->length / 2],
+		       (unsigned long long)latencies[trace->length - 1 - trace->length / 100],
+		       (unsigned long long)worst_ns, worst_call, trace->records[worst_call].op,
+		       trace->records[worst_call].size);
+	}
+
+	free(ptrs);
+	free(latencies);
+	return 0;
+}
+
+/*
+ * Prints how the program is used
+ */
+static void usage(const char *name) {
+	fprintf(stderr, "usage: %s replay <trace file> [sample interval]\n", name);
+	fprintf(stderr, "       %s run <workload> [iterations] [sample interval]\n", name);
+	fprintf(stderr, "       %s gen <workload> [iterations]\n", name);
+	fprintf(stderr, "workloads: ");
+	list_workloads(stderr);
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv) {
+	trace_t trace = {NULL, 0, 0};
+	uint32_t sample_interval = DEFAULT_SAMPLE_INTERVAL;
+
+	if (argc < 3) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (strcmp(argv[1], "replay") == 0) {
+		FILE *file = fopen(argv[2], "r");
+		if (file == NULL) {
+			perror(argv[2]);
+			return 1;
+		}
+		if (load_trace(file, &trace) == -1) {
+			fprintf(stderr, "%s: invalid trace\n", argv[2]);
+			return 1;
+		}
+		fclose(file);
+
+		if (argc > 3)
+			sample_interval = strtoul(argv[3], NULL, 0);
+	} else if (strcmp(argv[1], "run") == 0 || strcmp(argv[1], "gen") == 0) {
+		uint32_t iterations = (argc > 3) ? strtoul(argv[3], NULL, 0) : DEFAULT_ITERATIONS;
+		srand(WORKLOAD_SEED);
+		if (generate_workload(argv[2], iterations, &trace) == -1) {
+			usage(argv[0]);
+			return 1;
+		}
+
+		if (strcmp(argv[1], "gen") == 0) {
+			write_trace(stdout, &trace);
+			return 0;
+		}
+
+		if (argc > 4)
+			sample_interval = strtoul(argv[4], NULL, 0);
+	} else {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (sample_interval == 0)
+		sample_interval = DEFAULT_SAMPLE_INTERVAL;
+
+	return (replay_trace(&trace, sample_interval) == 0) ? 0 : 1;
+}
@@ -0,0 +1,54 @@
+#ifndef _HEAPBENCH_H
+#define _HEAPBENCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// The kernel's types.h conflicts with the C library's definitions of the same types,
+//  so kheap.h is included with the C library's types instead
+#define _TYPES_H
+#include "kheap.h"
+
+// A single call to kmalloc, kmalloc_aligned or kfree in a trace
+typedef struct trace_record {
+	// HEAP_TRACE_ALLOC, HEAP_TRACE_REALLOC or HEAP_TRACE_FREE
+	char op;
+	// The requested size and alignment (0 for kmalloc, or the pointer passed to krealloc),
+	//  or 0 for a free
+	uint32_t size;
+	uint32_t alignment;
+	// The pointer that the kernel returned or freed, which is only used to match frees with
+	//  allocations, or 0 if the allocation failed
+	uint32_t ptr;
+	// For a free or krealloc, the index of the record that allocated the pointer passed in, or -1
+	//  if the allocation happened before the trace started (filled in by match_trace)
+	int32_t match;
+} trace_record;
+
+// A growable list of trace records
+typedef struct trace_t {
+	trace_record *records;
+	uint32_t length;
+	uint32_t capacity;
+} trace_t;
+
+// Adds a record to the end of the trace, exiting if memory runs out
+void trace_append(trace_t *trace, char op, uint32_t size, uint32_t alignment, uint32_t ptr);
+// Reads a trace in the format of the kernel's HEAP_TRACE_FILENAME file, returning -1 on a parse error
+int load_trace(FILE *file, trace_t *trace);
+// Writes a trace in the format of the kernel's HEAP_TRACE_FILENAME file
+void write_trace(FILE *file, const trace_t *trace);
+
+// Fills in the trace with the allocations made by the named workload, returning -1 if there is
+//  no workload with that name
+int generate_workload(const char *name, uint32_t iterations, trace_t *trace);
+// Prints the names of the available workloads
+void list_workloads(FILE *file);
+
+// The size of a large page, which the heap grows and shrinks by
+#define LARGE_PAGE_SIZE 0x400000
+
+// Maps the hosted heap and initializes it, returning -1 on failure
+int init_hosted_heap(void);
+
+#endif
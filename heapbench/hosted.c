@@ -0,0 +1,68 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "heapbench.h"
+
+// The start of the hosted heap, which kheap_hosted.h uses in place of KERNEL_HEAP_START_ADDR
+void *kheap_hosted_base;
+// Stands in for the PIT's clock, which never advances in the benchmark
+double sys_time;
+
+/*
+ * Maps enough memory for the heap to grow to its largest size and initializes it
+ * kheap.c stores pointers in 32 bit integers, so the memory must lie in the low 4GB
+ *
+ * OUTPUTS: 0 on success and -1 on failure
+ */
+int init_hosted_heap(void) {
+	void *base = mmap(NULL, HOSTED_HEAP_MAX_SIZE, PROT_READ | PROT_WRITE,
+	                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	if (base == MAP_FAILED)
+		return -1;
+
+	kheap_hosted_base = base;
+	init_kheap();
+	return 0;
+}
+
+/*
+ * Stands in for the kernel's printf in the heap's debugging functions
+ */
+int kheap_hosted_printf(char *format, ...) {
+	va_list args;
+	va_start(args, format);
+	int retval = vprintf(format, args);
+	va_end(args);
+	return retval;
+}
+
+/*
+ * Stands in for claiming a large page as the heap grows; the memory is already mapped
+ */
+int32_t claim_heap_frame(void *addr) {
+	return 0;
+}
+
+/*
+ * Stands in for releasing a large page as the heap shrinks by discarding its contents,
+ *  which gives the memory back to the host
+ */
+void release_heap_frame(void *addr) {
+	madvise(addr, LARGE_PAGE_SIZE, MADV_DONTNEED);
+}
+
+/*
+ * Stands in for the kernel's memcpy in krealloc
+ */
+void* kheap_hosted_memcpy(void *dest, const void *src, uint32_t n) {
+	return memcpy(dest, src, n);
+}
+
+/*
+ * Stands in for the kernel's memset when blocks are cleared the first time they are used
+ */
+void* kheap_hosted_memset(void *s, int32_t c, uint32_t n) {
+	return memset(s, c, n);
+}
@@ -0,0 +1,49 @@
+#ifndef _KHEAP_HOSTED_H
+#define _KHEAP_HOSTED_H
+
+/*** Replacements for the kernel services used by kheap.c when it is compiled into the hosted
+ *** benchmark, which runs as an ordinary Linux program rather than inside the kernel ***/
+
+#include "types.h"
+
+// The page sizes must match paging.h, while the initial and largest sizes of the heap are set by
+//  the Makefile (the kernel's heap starts at 12MB and can grow to 56MB)
+#define NORMAL_PAGE_SIZE 0x1000
+#define LARGE_PAGE_SIZE 0x400000
+#define HEAP_SIZE HOSTED_HEAP_SIZE
+#define HEAP_MAX_SIZE HOSTED_HEAP_MAX_SIZE
+
+// The heap is placed wherever mmap puts it (below 4GB, so that pointers still fit in 32 bits)
+//  rather than at the fixed addresses used by the kernel
+extern void *kheap_hosted_base;
+#define KERNEL_HEAP_START_ADDR ((uint32_t)kheap_hosted_base)
+#define KERNEL_HEAP_END_ADDR (KERNEL_HEAP_START_ADDR + HEAP_SIZE)
+#define KERNEL_HEAP_MAX_ADDR (KERNEL_HEAP_START_ADDR + HEAP_MAX_SIZE)
+
+// The whole range that the heap can grow into is mapped up front, so growing always succeeds
+int32_t claim_heap_frame(void *addr);
+void release_heap_frame(void *addr);
+
+// The benchmark is single threaded, so there is nothing for the heap lock to protect against,
+//  and interrupts cannot be disabled from userspace anyway
+struct spinlock_t {
+	uint32_t flags;
+};
+#define SPIN_LOCK_UNLOCKED {0};
+#define spin_lock_irqsave(lock) do { } while (0)
+#define spin_unlock_irqsave(lock) do { } while (0)
+
+// The time since startup in seconds, which timestamps allocations when profiling
+extern double sys_time;
+
+// The debugging functions print through the C library instead of to the screen
+#define printf kheap_hosted_printf
+int32_t kheap_hosted_printf(int8_t *format, ...);
+// krealloc copies with the C library's memcpy, and blocks are cleared the first time they are used
+//  with its memset, both of which take a 64 bit size
+#define memcpy kheap_hosted_memcpy
+void* kheap_hosted_memcpy(void *dest, const void *src, uint32_t n);
+#define memset kheap_hosted_memset
+void* kheap_hosted_memset(void *s, int32_t c, uint32_t n);
+
+#endif
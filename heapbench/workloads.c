@@ -0,0 +1,271 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "heapbench.h"
+
+/*** Synthetic workloads that make the same sequences of allocations as parts of the kernel.
+ *** The sizes are those of the kernel's structures on i386, and the dynamic arrays are the
+ *** kernel's own macros, so the traces follow the resizing behaviour of dynamic_array.h ***/
+
+// The kernel structures whose allocations are simulated
+#define PCB_SIZE 288
+#define FILE_SIZE 16
+#define MEMORY_REGION_SIZE 24
+#define WINDOW_SIZE 68
+#define RECEIVED_UDP_PACKET_SIZE 3004
+#define ETHERNET_HEADER_SIZE 14
+#define IP_HEADER_SIZE 20
+#define UDP_HEADER_SIZE 8
+#define MAX_UDP_PAYLOAD 1472
+// The number of files that every process starts with (stdin, stdout, mouse, udp)
+#define NUM_DEFAULT_FILES 4
+// The maximum number of nested processes started by the spawn workload
+#define MAX_PROCESS_DEPTH 6
+// The number of packets the e1000 transmit ring holds before the oldest buffers are freed
+#define TX_RING_SIZE 8
+// The maximum number of windows open at once in the window workload
+#define MAX_WINDOWS 16
+
+// The trace that the allocation functions below record into
+static trace_t *cur_trace;
+// The pointer recorded for the next allocation; every allocation gets a unique value
+static uint32_t next_ptr = 1;
+
+/*
+ * Allocates real memory (since the dynamic array macros copy data) and records the allocation
+ * The recorded pointer is stored in front of the buffer so that the free can be recorded too
+ */
+static void* trace_kmalloc(uint32_t size) {
+	uint32_t *buf = malloc(size + sizeof(uint32_t));
+	if (buf == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+
+	buf[0] = next_ptr++;
+	trace_append(cur_trace, HEAP_TRACE_ALLOC, size, 0, buf[0]);
+	return &buf[1];
+}
+
+/*
+ * Records the free of a buffer returned by trace_kmalloc and releases it
+ */
+static void trace_kfree(void *ptr) {
+	if (ptr == NULL)
+		return;
+
+	uint32_t *buf = (uint32_t*)ptr - 1;
+	trace_append(cur_trace, HEAP_TRACE_FREE, 0, 0, buf[0]);
+	free(buf);
+}
+
+/*
+ * Records a resize of a buffer returned by trace_kmalloc, which always gets a new recorded pointer
+ */
+static void* trace_krealloc(void *ptr, uint32_t size) {
+	if (ptr == NULL)
+		return trace_kmalloc(size);
+	if (size == 0) {
+		trace_kfree(ptr);
+		return NULL;
+	}
+
+	uint32_t *buf = realloc((uint32_t*)ptr - 1, size + sizeof(uint32_t));
+	if (buf == NULL) {
+		perror("realloc");
+		exit(1);
+	}
+
+	uint32_t old_ptr = buf[0];
+	buf[0] = next_ptr++;
+	trace_append(cur_trace, HEAP_TRACE_REALLOC, size, old_ptr, buf[0]);
+	return &buf[1];
+}
+
+// The dynamic array macros call kmalloc, krealloc and kfree by name
+#define kmalloc trace_kmalloc
+#define krealloc trace_krealloc
+#define kfree trace_kfree
+#include "dynamic_array.h"
+
+typedef struct { char data[PCB_SIZE]; } fake_pcb;
+typedef struct { char data[FILE_SIZE]; } fake_file;
+typedef struct { char data[MEMORY_REGION_SIZE]; } fake_memory_region;
+typedef DYNAMIC_ARRAY(fake_pcb, pcb_arr) pcb_arr;
+typedef DYNAMIC_ARRAY(fake_memory_region, memory_region_arr) memory_region_arr;
+
+// The per-process dynamic arrays allocated by process_execute
+typedef struct fake_process {
+	DYNAMIC_ARRAY(fake_file, file_arr) files;
+	memory_region_arr memory_regions;
+} fake_process;
+
+/*
+ * Makes the allocations of process_execute: a new PCB and the process's files and memory regions
+ *  (one for each of the executable's text and data, and one for the stack)
+ */
+static void spawn_process(pcb_arr *pcbs, fake_process *process) {
+	fake_pcb pcb = {{0}};
+	fake_file file = {{0}};
+	fake_memory_region region = {{0}};
+	int i;
+
+	DYN_ARR_PUSH(fake_pcb, *pcbs, pcb);
+
+	DYN_ARR_INIT(fake_file, process->files);
+	for (i = 0; i < NUM_DEFAULT_FILES; i++)
+		DYN_ARR_PUSH(fake_file, process->files, file);
+
+	DYN_ARR_INIT(fake_memory_region, process->memory_regions);
+	DYN_ARR_RESERVE(fake_memory_region, process->memory_regions, 3);
+	for (i = 0; i < 3; i++)
+		DYN_ARR_PUSH(fake_memory_region, process->memory_regions, region);
+}
+
+/*
+ * Makes the frees of free_pid for the most recently spawned process
+ */
+static void halt_process(pcb_arr *pcbs, fake_process *process) {
+	DYN_ARR_DELETE(process->files);
+	DYN_ARR_DELETE(process->memory_regions);
+	DYN_ARR_POP(fake_pcb, *pcbs);
+}
+
+/*
+ * Programs being started and halted from a shell, sometimes nested inside each other, with the
+ *  occasional file being opened and closed by the running program
+ */
+static void spawn_workload(uint32_t iterations) {
+	pcb_arr pcbs;
+	fake_process processes[MAX_PROCESS_DEPTH];
+	fake_file file = {{0}};
+	int depth = 0;
+	uint32_t i;
+
+	DYN_ARR_INIT(fake_pcb, pcbs);
+
+	for (i = 0; i < iterations; i++) {
+		int action = rand() % 4;
+		if (depth == 0 || (action == 0 && depth < MAX_PROCESS_DEPTH)) {
+			spawn_process(&pcbs, &processes[depth++]);
+		} else if (action == 1) {
+			halt_process(&pcbs, &processes[--depth]);
+		} else if (action == 2) {
+			DYN_ARR_PUSH(fake_file, processes[depth - 1].files, file);
+		} else if (processes[depth - 1].files.length > NUM_DEFAULT_FILES) {
+			DYN_ARR_POP(fake_file, processes[depth - 1].files);
+		}
+	}
+
+	while (depth > 0)
+		halt_process(&pcbs, &processes[--depth]);
+	DYN_ARR_DELETE(pcbs);
+}
+
+/*
+ * UDP packets being sent and received: every send allocates in udp_send, ethernet_send and the
+ *  e1000 driver, where the buffer is only freed once the transmit ring wraps around
+ */
+static void udp_workload(uint32_t iterations) {
+	void *tx_ring[TX_RING_SIZE] = {NULL};
+	int tx_index = 0;
+	uint32_t i;
+
+	for (i = 0; i < iterations; i++) {
+		if (rand() % 2 == 0) {
+			uint32_t payload = 1 + rand() % MAX_UDP_PAYLOAD;
+			uint32_t ip_size = payload + IP_HEADER_SIZE + UDP_HEADER_SIZE;
+
+			void *udp_packet = kmalloc(ip_size);
+			void *ethernet_packet = kmalloc(ip_size + ETHERNET_HEADER_SIZE);
+
+			kfree(tx_ring[tx_index]);
+			tx_ring[tx_index] = kmalloc(ip_size + ETHERNET_HEADER_SIZE);
+			tx_index = (tx_index + 1) % TX_RING_SIZE;
+
+			kfree(ethernet_packet);
+			kfree(udp_packet);
+		} else {
+			kfree(kmalloc(RECEIVED_UDP_PACKET_SIZE));
+		}
+	}
+
+	for (i = 0; i < TX_RING_SIZE; i++)
+		kfree(tx_ring[i]);
+}
+
+/*
+ * Windows being opened and closed in a random order while the owning process's memory regions grow,
+ *  which leaves long lived allocations scattered between short lived ones
+ */
+static void window_workload(uint32_t iterations) {
+	memory_region_arr regions;
+	void *windows[MAX_WINDOWS] = {NULL};
+	fake_memory_region region = {{0}};
+	uint32_t i;
+
+	DYN_ARR_INIT(fake_memory_region, regions);
+
+	for (i = 0; i < iterations; i++) {
+		int index = rand() % MAX_WINDOWS;
+		if (windows[index] == NULL) {
+			DYN_ARR_PUSH(fake_memory_region, regions, region);
+			windows[index] = kmalloc(WINDOW_SIZE);
+		} else {
+			kfree(windows[index]);
+			windows[index] = NULL;
+			DYN_ARR_POP(fake_memory_region, regions);
+		}
+
+		// Drawing into a window sends its contents over the network every so often
+		if (rand() % 4 == 0)
+			kfree(kmalloc(IP_HEADER_SIZE + UDP_HEADER_SIZE + rand() % MAX_UDP_PAYLOAD));
+	}
+
+	for (i = 0; i < MAX_WINDOWS; i++)
+		kfree(windows[i]);
+	DYN_ARR_DELETE(regions);
+}
+
+// The workloads that can be selected by name
+static struct {
+	const char *name;
+	void (*run)(uint32_t iterations);
+} workloads[] = {
+	{"spawn", spawn_workload},
+	{"udp", udp_workload},
+	{"window", window_workload}
+};
+
+#define NUM_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+/*
+ * Fills in the trace with the allocations made by the named workload
+ *
+ * INPUTS: name: the name of one of the workloads
+ *         iterations: the number of steps the workload takes
+ *         trace: an empty trace to record into
+ * OUTPUTS: 0 on success and -1 if there is no workload with that name
+ */
+int generate_workload(const char *name, uint32_t iterations, trace_t *trace) {
+	unsigned i;
+	for (i = 0; i < NUM_WORKLOADS; i++) {
+		if (strcmp(name, workloads[i].name) == 0) {
+			cur_trace = trace;
+			workloads[i].run(iterations);
+			cur_trace = NULL;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Prints the names of the available workloads, separated by spaces
+ */
+void list_workloads(FILE *file) {
+	unsigned i;
+	for (i = 0; i < NUM_WORKLOADS; i++)
+		fprintf(file, "%s%s", (i == 0) ? "" : " ", workloads[i].name);
+}
@@ -9,12 +9,17 @@
 // The code is written under the assumption that this is an integer, and since 1 is too small,
 //  and any larger amount would be inefficient, 2 is the best choice. This should not be changed
 #define DYN_ARR_RESIZE_FACTOR 2
+// The array only shrinks once it is this many times smaller than its capacity, so that the capacity
+//  after shrinking still leaves room to grow, and alternating pushes and pops do not resize every time
+#define DYN_ARR_SHRINK_THRESHOLD 4
 
 // Defines a generic dynamic array struct given the TYPE of the data stored,
 //  and the name of the resulting dynamic array type (TYPE_NAME)
 #define DYNAMIC_ARRAY(TYPE, TYPE_NAME) struct TYPE_NAME { \
 	uint32_t capacity;                                    \
 	uint32_t length;                                      \
+	/* The capacity will never shrink below this (see DYN_ARR_RESERVE) */ \
+	uint32_t min_capacity;                                \
 	TYPE *data;                                           \
 }
 
@@ -28,6 +33,7 @@
 #define DYN_ARR_INIT(TYPE, dyn_arr) ({ \
 	dyn_arr.capacity = 1; \
 	dyn_arr.length = 0; \
+	dyn_arr.min_capacity = 1; \
 	dyn_arr.data = kmalloc(sizeof(TYPE)); \
 })
 
@@ -38,6 +44,31 @@
  */
 #define DYN_ARR_DELETE(dyn_arr) kfree((dyn_arr).data)
 
+/*
+ * Makes sure that the array can hold at least the given number of elements without resizing, and
+ *  that it never shrinks below that, for arrays whose length is expected to go up and down
+ *
+ * INPUTS: TYPE: the type of the data that this dynamic array contains
+ *         dyn_arr: the dynamic array to reserve memory for
+ *         num_elements: the number of elements to reserve memory for
+ * OUTPUTS: 0 on success and -1 if the memory could not be allocated
+ */
+#define DYN_ARR_RESERVE(TYPE, dyn_arr, num_elements) ({ \
+	int retval = 0; \
+	if ((num_elements) > (dyn_arr).capacity) { \
+		TYPE *new_data = krealloc((dyn_arr).data, (num_elements) * sizeof(TYPE)); \
+		if (new_data != NULL) { \
+			(dyn_arr).data = new_data; \
+			(dyn_arr).capacity = (num_elements); \
+		} else { \
+			retval = -1; \
+		} \
+	} \
+	if (retval == 0 && (num_elements) > (dyn_arr).min_capacity) \
+		(dyn_arr).min_capacity = (num_elements); \
+	retval; /* Return the value from the statement expression */ \
+})
+
 /*
  * Adds an element to the end of the array, resizing the memory if necessary
  *
@@ -47,19 +78,14 @@
  * OUTPUTS: the index of the newly added data, or -1 if it failed
  */
 #define DYN_ARR_PUSH(TYPE, dyn_arr, new_element) ({ \
-	TYPE *new_data = NULL; \
-	if ((dyn_arr).length == (dyn_arr).capacity) \
-		new_data = kmalloc((DYN_ARR_RESIZE_FACTOR * (dyn_arr).capacity) * sizeof(TYPE)); \
-	if (new_data != NULL) { \
-		/* Copy over the old data */ \
-		int i; \
-		for (i = 0; i < (dyn_arr).length; i++) \
-			new_data[i] = (dyn_arr).data[i]; \
-		/* Free the old memory and set data to new_data */ \
-		kfree((dyn_arr).data); \
-		(dyn_arr).data = new_data; \
-		/* Update the capacity */ \
-		(dyn_arr).capacity = DYN_ARR_RESIZE_FACTOR * (dyn_arr).capacity; \
+	if ((dyn_arr).length == (dyn_arr).capacity) { \
+		/* Grow the memory, which keeps the old data (and often does not need to move it) */ \
+		TYPE *new_data = krealloc((dyn_arr).data, \
+			(DYN_ARR_RESIZE_FACTOR * (dyn_arr).capacity) * sizeof(TYPE)); \
+		if (new_data != NULL) { \
+			(dyn_arr).data = new_data; \
+			(dyn_arr).capacity = DYN_ARR_RESIZE_FACTOR * (dyn_arr).capacity; \
+		} \
 	} \
 	int retval = -1; /* -1 indicates that the malloc failed */ \
 	if ((dyn_arr).length != (dyn_arr).capacity) { \
@@ -72,7 +98,7 @@
 })
 
 /*
- * Removes the last element of the array, resizing the memory if convenient
+ * Removes the last element of the array, shrinking the memory once the array is mostly empty
  * This function does not check if the array is already empty
  *
  * INPUTS: TYPE: the type of the data that this dynamic array contains
@@ -80,18 +106,15 @@
  */
 #define DYN_ARR_POP(TYPE, dyn_arr) ({ \
 	(dyn_arr).length -= 1; \
-	if ((dyn_arr).length * DYN_ARR_RESIZE_FACTOR < (dyn_arr).capacity) { \
-		/* Resize the array to have a capacity of dyn_arr.length + 1 */ \
-		(dyn_arr).capacity = (dyn_arr).length + 1; \
-		TYPE *new_data = kmalloc((dyn_arr).capacity * sizeof(TYPE)); \
-		/* Copy over the old data if the allocation succeeded */ \
+	if ((dyn_arr).length * DYN_ARR_SHRINK_THRESHOLD <= (dyn_arr).capacity && \
+		(dyn_arr).capacity / DYN_ARR_RESIZE_FACTOR >= (dyn_arr).min_capacity) { \
+		/* Shrink the memory, which keeps the data (and does not move it unless it is small) */ \
+		TYPE *new_data = krealloc((dyn_arr).data, \
+			((dyn_arr).capacity / DYN_ARR_RESIZE_FACTOR) * sizeof(TYPE)); \
+		/* If shrinking fails, the array keeps its old memory, which is still valid */ \
 		if (new_data != NULL) { \
-			int i; \
-			for (i = 0; i < (dyn_arr).length; i++) \
-				new_data[i] = (dyn_arr).data[i]; \
-			/* Free the old data and set data to new_data */ \
-			kfree((dyn_arr).data); \
 			(dyn_arr).data = new_data; \
+			(dyn_arr).capacity = (dyn_arr).capacity / DYN_ARR_RESIZE_FACTOR; \
 		} \
 	} \
 })
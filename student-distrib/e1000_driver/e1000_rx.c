@@ -3,6 +3,8 @@
 #include "../pci.h"
 #include "../kheap.h"
 #include "../network/ethernet.h"
+#include "../work_queue.h"
+#include "../lib.h"
 
 // The descriptor buffer that will be shared between the ethernet controller and the kernel
 static volatile uint8_t rx_desc_buf[RX_DESCRIPTOR_BUFFER_SIZE * RX_DESCRIPTOR_SIZE] __attribute__((aligned (RX_DESCRIPTOR_BUFFER_ALIGNMENT)));
@@ -103,17 +105,23 @@ int e1000_init_rx(volatile uint8_t *eth_mmio_base) {
 
 static int cur_descriptor = 0;
 
+// The memory-mapped I/O and the eth_device that receive_packets works with, which are set by the
+//  receive interrupt handler
+static volatile uint8_t *rx_mmio_base;
+static eth_device *rx_device;
+
 /*
- * Interrupt handler for packet receive-related interrupts
- * INPUTS: eth_mmio_base: pointer to the start of memory-mapped I/O for the E1000
- *         interrupt_cause: the contents of the Interrupt Cause Read register
- *         device: a pointer to the eth_device 
- * OUTPUTS: 0 if the interrupt was handled and -1 if not
+ * Hands every packet that the E1000 has received to the network stack and gives the descriptors back
+ *  to the E1000, which is run by the worker thread after a receive interrupt rather than in it
+ * Each packet is handled with interrupts disabled, since the network stack shares its tables with
+ *  system calls that only disable interrupts while they use them
+ *
+ * INPUTS: unused: the data of the work item
  */
-inline int e1000_rx_irq_handler(volatile uint8_t *eth_mmio_base, uint32_t interrupt_cause, eth_device *device) {
-	// Make sure this interrupt is for ethernet frame reception
-	if (!(interrupt_cause & ETH_IMS_RXT0 || interrupt_cause & ETH_IMS_RXDMT0))
-		return -1;
+static void receive_packets(void *unused) {
+	volatile uint8_t *eth_mmio_base = rx_mmio_base;
+	eth_device *device = rx_device;
+	uint32_t flags;
 
 	struct rx_descriptor cur;
 	while (1) {
@@ -127,12 +135,15 @@ inline int e1000_rx_irq_handler(volatile uint8_t *eth_mmio_base, uint32_t interr
 			// Make sure it is one entire packet, we do not support packets split between frames
 			if ((cur.status & ETH_STATUS_END_OF_PACKET) == 0) {
 				E1000_DEBUG("Received incomplete packet split between frames, ignoring...\n");
-				return 0;
+				return;
 			}
 
 			// Process the packet as a full Ethernet packet
-			if (device != NULL && device->receive != NULL)
+			if (device != NULL && device->receive != NULL) {
+				cli_and_save(flags);
 				device->receive(cur.buf_addr, cur.length, device->id);
+				restore_flags(flags);
+			}
 
 			// Write back with desc_done not set
 			cur.status &= ~ETH_STATUS_DESC_DONE;
@@ -147,6 +158,26 @@ inline int e1000_rx_irq_handler(volatile uint8_t *eth_mmio_base, uint32_t interr
 
 	// Write back cur_descriptor - 1 to E1000
 	GET_32(eth_mmio_base, ETH_RX_DESCRIPTOR_TAIL) = (cur_descriptor + RX_DESCRIPTOR_BUFFER_SIZE - 1) % RX_DESCRIPTOR_BUFFER_SIZE;
+}
+
+static work_t rx_work = WORK_INIT(receive_packets, NULL);
+
+/*
+ * Interrupt handler for packet receive-related interrupts, which leaves the packets to be handled by
+ *  the worker thread (see receive_packets)
+ * INPUTS: eth_mmio_base: pointer to the start of memory-mapped I/O for the E1000
+ *         interrupt_cause: the contents of the Interrupt Cause Read register
+ *         device: a pointer to the eth_device 
+ * OUTPUTS: 0 if the interrupt was handled and -1 if not
+ */
+inline int e1000_rx_irq_handler(volatile uint8_t *eth_mmio_base, uint32_t interrupt_cause, eth_device *device) {
+	// Make sure this interrupt is for ethernet frame reception
+	if (!(interrupt_cause & ETH_IMS_RXT0 || interrupt_cause & ETH_IMS_RXDMT0))
+		return -1;
+
+	rx_mmio_base = eth_mmio_base;
+	rx_device = device;
+	queue_work(&rx_work);
 
 	return 0;
 }
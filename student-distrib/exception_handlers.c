@@ -108,14 +108,14 @@ GENERATE_EXCEPTION_HANDLER(breakpoint_handler, "BREAKPOINT EXCEPTION", {}, {})
 GENERATE_EXCEPTION_HANDLER(overflow_handler, "OVERFLOW EXCEPTION", {}, {})
 GENERATE_EXCEPTION_HANDLER(bound_range_exceeded_handler, "BOUND RANGE EXCEEDED EXCEPTION", {}, {})
 GENERATE_EXCEPTION_HANDLER(invalid_opcode_handler, "INVALID OPCODE EXCEPTION", {}, {})
-GENERATE_EXCEPTION_HANDLER(device_na_handler, "DEVICE NOT AVAILABLE EXCEPTION", {}, {})
+GENERATE_EXCEPTION_HANDLER(invalid_device_na_handler, "DEVICE NOT AVAILABLE EXCEPTION", {}, {})
 GENERATE_EXCEPTION_HANDLER(double_fault_handler, "DOUBLE FAULT EXCEPTION", {}, {})
 GENERATE_EXCEPTION_HANDLER(coprocessor_segment_overrun_handler, "COPROCESSOR SEGMENT EXCEPTION", {}, {})
 GENERATE_EXCEPTION_HANDLER(invalid_tss_handler, "INVALID TSS EXCEPTION", {}, {})
 GENERATE_EXCEPTION_HANDLER(segment_np_handler, "SEGMENT NOT PRESENT EXCEPTION", {}, {})
 GENERATE_EXCEPTION_HANDLER(stack_segment_fault_handler, "STACK SEGMENT FAULT EXCEPTION", {}, {})
 GENERATE_EXCEPTION_HANDLER(general_protection_handler, "GENERAL PROTECTION EXCEPTION", {}, {})
-GENERATE_EXCEPTION_HANDLER(page_fault_handler, "PAGE FAULT EXCEPTION", {
+GENERATE_EXCEPTION_HANDLER(invalid_page_fault_handler, "PAGE FAULT EXCEPTION", {
 	uint32_t address;
     asm("movl %%cr2, %0": "=r" (address));
     return printf("Invalid memory access attempt at 0x%#x", address);
@@ -125,6 +125,33 @@ GENERATE_EXCEPTION_HANDLER(alignment_check_handler, "ALIGNMENT CHE EXCEPTION", {
 GENERATE_EXCEPTION_HANDLER(machine_check_handler, "MACHINE CHECK EXCEPTION", {}, {})
 GENERATE_EXCEPTION_HANDLER(floating_point_exception_handler, "SIMD FLOATING POINT EXCEPTION", {}, {})
 
+/*
+ * Handles page faults, most of which come from a process accessing one of its pages for the first
+ *  time (including through a system call), in which case the page is filled in and the access is retried
+ * Any other page fault is an invalid memory access, which is handled like the other exceptions
+ */
+void page_fault_handler() {
+	uint32_t address;
+	asm("movl %%cr2, %0": "=r" (address));
+
+	if (process_page_fault((void*)address) == 0)
+		return;
+
+	invalid_page_fault_handler();
+}
+
+/*
+ * Handles the FPU being used by a process that does not have its registers in the FPU, which gives
+ *  the FPU to that process and retries the instruction
+ * If the registers could not be switched, this is handled like the other exceptions
+ */
+void device_na_handler() {
+	if (process_fpu_fault() == 0)
+		return;
+
+	invalid_device_na_handler();
+}
+
 /* Fill in exception handlers array with all assembly linkages for exception handlers */
 uint32_t exception_handlers[NUM_EXCEPTION_HANDLERS] = {
 	(uint32_t)divide_zero_linkage,
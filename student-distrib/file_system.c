@@ -132,6 +132,71 @@ int32_t fs_load(const int8_t *fname, void *address) {
 	return 0;
 }
 
+/*
+ * Description: Gets the size of the file with name 'fname'.
+ * Inputs: fname- name of file
+ * Returns: -1- failure (nonexistent file)
+ *           n- the size of the file in bytes
+ */
+int32_t fs_size(const int8_t *fname) {
+	/* Local variables. */
+	dentry_t dentry;
+
+	/* Check for invalid file name. */
+	if (fname == NULL)
+		return -1;
+
+	/* Extract dentry information using the filename passed in. */
+	if (read_dentry_by_name((uint8_t*)fname, &dentry) == -1)
+		return -1;
+
+	return inodes[dentry.inode].size;
+}
+
+/*
+ * Description: Gets the size of the file with the inode 'inode'.
+ * Inputs: inode- inode of the file
+ * Returns: -1- failure (invalid inode)
+ *           n- the size of the file in bytes
+ */
+int32_t fs_inode_size(uint32_t inode) {
+	/* Check for an invalid inode number. */
+	if (inode >= fs_stats.num_inodes)
+		return -1;
+
+	return inodes[inode].size;
+}
+
+/*
+ * Description: Gets the physical frame of the data block that holds the given
+ * offset in a file, so that the block can be mapped into memory instead of
+ * being copied. The file system image is a multiboot module in identity mapped
+ * memory, so this only works if the bootloader placed it on a page boundary.
+ * Inputs: inode- inode of the file
+ *         offset- offset in the file
+ * Returns: -1- failure (invalid inode or offset, or unaligned image)
+ *           n- the index of the frame (its physical address divided by 4kB)
+ */
+int32_t fs_data_block_frame(uint32_t inode, uint32_t offset) {
+	/* Local variables. */
+	uint32_t data_block;
+
+	/* Check for an invalid inode number or offset. */
+	if (inode >= fs_stats.num_inodes || offset >= inodes[inode].size)
+		return -1;
+
+	/* Data blocks are only pages of their own if the image is page aligned. */
+	if (data_start % FS_PAGE_SIZE != 0)
+		return -1;
+
+	/* Check for an invalid data block. */
+	data_block = inodes[inode].data_blocks[offset / FS_PAGE_SIZE];
+	if (data_block >= fs_stats.num_datablocks)
+		return -1;
+
+	return (data_start + data_block * FS_PAGE_SIZE) / FS_PAGE_SIZE;
+}
+
 /*
  * Description: Initializes global variables associated with the file system.
  * Inputs: fs_start- start
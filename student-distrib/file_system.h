@@ -92,6 +92,15 @@ int32_t fs_write(void);
 /* Loads an executable file into memory and prepares to begin the new process */
 int32_t fs_load(const int8_t *fname, void *address);
 
+/* Gets the size of the file with name 'fname'. */
+int32_t fs_size(const int8_t *fname);
+
+/* Gets the size of the file with the inode 'inode'. */
+int32_t fs_inode_size(uint32_t inode);
+
+/* Gets the physical frame of the data block that holds 'offset' in the file with the inode 'inode'. */
+int32_t fs_data_block_frame(uint32_t inode, uint32_t offset);
+
 /* Initializes global variables associated with the file system. */
 void fs_init(uint32_t fs_start, uint32_t fs_end);
 
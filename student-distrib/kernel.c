@@ -23,6 +23,7 @@
 #include "graphics/graphics.h"
 #include "window_manager/window_manager.h"
 #include "signals.h"
+#include "work_queue.h"
 
 /* Macros. */
 /* Check if the bit BIT in FLAGS is set. */
@@ -102,7 +103,7 @@ void entry(unsigned long magic, unsigned long addr) {
 				(unsigned)mbi->mmap_addr, (unsigned)mbi->mmap_length);
 		for (mmap = (memory_map_t *)mbi->mmap_addr;
 				(unsigned long)mmap < mbi->mmap_addr + mbi->mmap_length;
-				mmap = (memory_map_t *)((unsigned long)mmap + mmap->size + sizeof (mmap->size)))
+				mmap = (memory_map_t *)((unsigned long)mmap + mmap->size + sizeof (mmap->size))) {
 			printf("    size = 0x%x, base_addr = 0x%#x%#x\n    type = 0x%x,  length    = 0x%#x%#x\n",
 					(unsigned)mmap->size,
 					(unsigned)mmap->base_addr_high,
@@ -110,6 +111,14 @@ void entry(unsigned long magic, unsigned long addr) {
 					(unsigned)mmap->type,
 					(unsigned)mmap->length_high,
 					(unsigned)mmap->length_low);
+
+			// Hand the usable memory below 4GB to the frame allocator
+			if (mmap->type == MULTIBOOT_MEMORY_AVAILABLE && mmap->base_addr_high == 0)
+				add_physical_memory(mmap->base_addr_low, mmap->length_high ? -mmap->base_addr_low : mmap->length_low);
+		}
+	} else if (CHECK_FLAG(mbi->flags, 0)) {
+		// Without a memory map, all that is known is the size of the memory starting at 1MB
+		add_physical_memory(0x100000, mbi->mem_upper * 1024);
 	}
 
 	/* Construct an LDT entry in the GDT */
@@ -216,9 +225,15 @@ void entry(unsigned long magic, unsigned long addr) {
 
 		enable_scheduling();
 
+		/* Start the worker thread and the first program with interrupts disabled, since the
+		 * scheduler expects to be on the kernel stack of a process once one exists */
+		cli();
+		init_work_queue();
+
 		// process_execute("window", 0);
 		/* Execute the first program ("shell") ... */
 		process_execute("shell", 0, 1, 0);
+		sti();
 	}
 
 	/* Unregister the E1000 Ethernet device */
@@ -0,0 +1,158 @@
+#include "kernel_stack.h"
+#include "lib.h"
+#include "spinlock.h"
+
+// Kernel stacks are allocated from whole 4MB pages set aside for only this purpose rather than from
+//  the kernel heap, since each stack must be aligned to its size, and carving aligned blocks out of
+//  the heap over and over leaves behind small unaligned slivers that fragment it
+
+// The amount of memory taken up by a single stack along with its guard gap
+#define KERNEL_STACK_SLOT_SIZE (KERNEL_STACK_SIZE + KERNEL_STACK_GUARD_SIZE)
+// The number of stacks that fit in a single 4MB page
+#define KERNEL_STACKS_PER_PAGE (LARGE_PAGE_SIZE / KERNEL_STACK_SLOT_SIZE)
+
+// The indices of the large pages that make up the pool
+static int32_t pool_pages[MAX_KERNEL_STACK_POOL_PAGES];
+// The number of large pages that make up the pool
+static int32_t num_pool_pages = 0;
+
+// For each unused stack, the index of another unused stack, which forms a linked list of unused stacks
+//  where the last item points to -1 (the index of a stack is pool page * stacks per page + slot)
+// If the stack is in use, this value is a don't care
+static int16_t next_free[MAX_KERNEL_STACK_POOL_PAGES * KERNEL_STACKS_PER_PAGE];
+// The index of the head of the linked list of unused stacks
+static int32_t unused_stack_head_index = -1;
+
+static struct spinlock_t kernel_stack_lock = SPIN_LOCK_UNLOCKED;
+
+/*
+ * Gets the lowest address of the stack with the given index
+ */
+static inline void* get_stack_addr(int32_t index) {
+	return phys_to_virt(pool_pages[index / KERNEL_STACKS_PER_PAGE] * LARGE_PAGE_SIZE +
+		(index % KERNEL_STACKS_PER_PAGE) * KERNEL_STACK_SLOT_SIZE + KERNEL_STACK_GUARD_SIZE);
+}
+
+/*
+ * Claims another 4MB page for the pool and adds all the stacks within it to the list of unused stacks
+ * kernel_stack_lock must be held when calling this function
+ *
+ * OUTPUTS: -1 if no more pages could be added to the pool and 0 on success
+ */
+static int32_t grow_pool() {
+	if (num_pool_pages == MAX_KERNEL_STACK_POOL_PAGES)
+		return -1;
+
+	int32_t page = get_open_page();
+	if (page == -1)
+		return -1;
+
+	// The page is reached through the kernel's mapping of physical memory, which every process shares
+	pool_pages[num_pool_pages] = page;
+
+	// Link all the stacks in the page together in order of address and put them at the head of the list
+	int32_t first = num_pool_pages * KERNEL_STACKS_PER_PAGE;
+	int32_t i;
+	for (i = first; i < first + KERNEL_STACKS_PER_PAGE - 1; i++)
+		next_free[i] = i + 1;
+	next_free[first + KERNEL_STACKS_PER_PAGE - 1] = unused_stack_head_index;
+	unused_stack_head_index = first;
+
+	num_pool_pages++;
+
+#if KERNEL_STACK_GUARD_SIZE > 0
+	// Fill in all the guard gaps so that overflows can be detected
+	for (i = first; i < first + KERNEL_STACKS_PER_PAGE; i++) {
+		uint32_t *guard = get_stack_addr(i) - KERNEL_STACK_GUARD_SIZE;
+		int32_t j;
+		for (j = 0; j < KERNEL_STACK_GUARD_SIZE / sizeof(uint32_t); j++)
+			guard[j] = KERNEL_STACK_GUARD_MAGIC;
+	}
+#endif
+
+	return 0;
+}
+
+/*
+ * Sets aside the first page of memory for kernel stacks
+ *
+ * OUTPUTS: -1 if no memory could be set aside and 0 on success
+ */
+int32_t init_kernel_stacks() {
+	spin_lock_irqsave(kernel_stack_lock);
+	int32_t retval = grow_pool();
+	spin_unlock_irqsave(kernel_stack_lock);
+
+	return retval;
+}
+
+/*
+ * Returns the lowest address of an unused kernel stack, growing the pool if it is empty
+ *
+ * OUTPUTS: a KERNEL_STACK_SIZE byte region aligned to KERNEL_STACK_SIZE, or NULL if none are left
+ */
+void* alloc_kernel_stack() {
+	spin_lock_irqsave(kernel_stack_lock);
+
+	if (unused_stack_head_index < 0 && grow_pool() != 0) {
+		spin_unlock_irqsave(kernel_stack_lock);
+		return NULL;
+	}
+
+	// Simply pick the head of the unused stack linked list
+	int32_t index = unused_stack_head_index;
+	unused_stack_head_index = next_free[index];
+
+	spin_unlock_irqsave(kernel_stack_lock);
+	return get_stack_addr(index);
+}
+
+/*
+ * Returns a kernel stack previously returned by alloc_kernel_stack to the pool
+ * The stack memory itself is not touched, so it is safe to free the stack that is currently in use
+ *  as long as interrupts remain disabled until we switch off of it
+ *
+ * INPUTS: stack: the lowest address of the kernel stack
+ */
+void free_kernel_stack(void *stack) {
+	if (stack == NULL)
+		return;
+
+	spin_lock_irqsave(kernel_stack_lock);
+
+	// Find the page of the pool that the stack lies in
+	int32_t page;
+	for (page = 0; page < num_pool_pages; page++) {
+		uint32_t page_start = (uint32_t)phys_to_virt(pool_pages[page] * LARGE_PAGE_SIZE);
+		if ((uint32_t)stack >= page_start && (uint32_t)stack < page_start + LARGE_PAGE_SIZE)
+			break;
+	}
+
+	// Ignore stacks that did not come from the pool
+	if (page == num_pool_pages) {
+		spin_unlock_irqsave(kernel_stack_lock);
+		return;
+	}
+
+	int32_t index = page * KERNEL_STACKS_PER_PAGE +
+		((uint32_t)stack - (uint32_t)phys_to_virt(pool_pages[page] * LARGE_PAGE_SIZE)) / KERNEL_STACK_SLOT_SIZE;
+
+#if KERNEL_STACK_GUARD_SIZE > 0
+	// Check that the process did not overflow its kernel stack into the guard gap, and repair
+	//  the guard gap if it did so that the next owner of the stack is checked correctly
+	uint32_t *guard = stack - KERNEL_STACK_GUARD_SIZE;
+	int32_t j, overflowed = 0;
+	for (j = 0; j < KERNEL_STACK_GUARD_SIZE / sizeof(uint32_t); j++) {
+		overflowed |= (guard[j] != KERNEL_STACK_GUARD_MAGIC);
+		guard[j] = KERNEL_STACK_GUARD_MAGIC;
+	}
+	if (overflowed)
+		printf("KERNEL STACK OVERFLOW DETECTED AT 0x%x\n", stack);
+#endif
+
+	// Set this to point to the old head, and let this be the new head of the unused stack linked list
+	next_free[index] = unused_stack_head_index;
+	unused_stack_head_index = index;
+
+	spin_unlock_irqsave(kernel_stack_lock);
+}
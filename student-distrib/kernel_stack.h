@@ -0,0 +1,25 @@
+#ifndef _KERNEL_STACK_H
+#define _KERNEL_STACK_H
+
+#include "types.h"
+#include "paging.h"
+
+// The number of 4MB pages that the kernel stack pool may grow to (512 stacks per page without guards)
+#define MAX_KERNEL_STACK_POOL_PAGES 4
+
+// The size of the unused gap placed below each kernel stack, which is filled with KERNEL_STACK_GUARD_MAGIC
+//  and checked when the stack is freed so that stack overflows are reported instead of silently
+//  corrupting the neighbouring stack
+// Set to 0 to disable guard gaps; otherwise it must be a multiple of KERNEL_STACK_SIZE so that
+//  every stack stays aligned to its own size (which get_pid relies on)
+#define KERNEL_STACK_GUARD_SIZE 0
+#define KERNEL_STACK_GUARD_MAGIC 0xDEADCA75
+
+// Sets aside the first page of memory for kernel stacks
+int32_t init_kernel_stacks();
+// Returns the lowest address of an unused KERNEL_STACK_SIZE aligned kernel stack, or NULL if none are left
+void* alloc_kernel_stack();
+// Returns a kernel stack previously returned by alloc_kernel_stack to the pool
+void free_kernel_stack(void *stack);
+
+#endif
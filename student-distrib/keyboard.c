@@ -35,6 +35,9 @@ static unsigned int keyboard_init = 0;
 //line buffer to store everything typed into terminal
 unsigned char linebuffer[NUM_TEXT_TTYS][TERMINAL_SIZE];
 
+// The processes in each TTY that are waiting in terminal_read for a line to be entered
+static wait_queue_t terminal_read_queues[NUM_TEXT_TTYS];
+
 /* KBDUS means US Keyboard Layout.
  * CREDIT TO http://www.osdever.net/bkerndev/Docs/keyboard.htm
  * where we got the following scancode to ascii mapping */
@@ -180,9 +183,10 @@ void init_keyboard() {
 			linebuffer[j][i] = '\0';
 	}
 
-	// Initialize the line positions
+	// Initialize the line positions and the queues of processes waiting for a line
 	for (i = 0; i < NUM_TEXT_TTYS; i++) {
 		linepos[i] = 0;
+		terminal_read_queues[i] = (wait_queue_t)WAIT_QUEUE_EMPTY;
 	}
 
 	// Update cursor to point at beginning
@@ -375,15 +379,9 @@ void keyboard_handler() {
 		linebuffer[active_tty - 1][linepos[active_tty - 1]] = '\0';
 		linepos[active_tty - 1] = 0;
 
-		// Look through all processes to find any that are in the current TTY and blocking on terminal read
-		for (i = 0; i < pcbs.length; i++) {
-			if (pcbs.data[i].pid >= 0 && pcbs.data[i].tty == active_tty && 
-				pcbs.data[i].blocking_call.type == BLOCKING_CALL_TERMINAL_READ) {
-				// Wake up the process, because it has received data
-				process_wake(i);
-				break;
-			}
-		}
+		// Wake up the process in the current TTY that has been blocking on terminal read the longest,
+		//  because it has received data
+		wake_up(&terminal_read_queues[active_tty - 1]);
 
 		// Return, since we have printed the character already
 		goto keyboard_handler_end;
@@ -547,8 +545,8 @@ int32_t terminal_read(int32_t fd, char* buf, int32_t bytes) {
 	// Set the blocking call field in the PCB
 	pcb->blocking_call.type = BLOCKING_CALL_TERMINAL_READ;
 
-	// Put the process to sleep
-	process_sleep(pcb->pid);
+	// Put the process to sleep until a line is entered in its TTY
+	process_wait(&terminal_read_queues[tty - 1]);
 
 	// Execution will return to here when the process is woken up
 	// Disable interrupts so that keyboard_handler doesn't touch linebuffer during read
@@ -1,6 +1,16 @@
 #include "kheap.h"
+
+// The hosted benchmark (see heapbench/) compiles this file as a Linux program, with a header of its
+//  own in place of the kernel services used by the heap
+#ifdef KHEAP_HOSTED
+#include "kheap_hosted.h"
+#else
+#include "paging.h"
 #include "spinlock.h"
 #include "lib.h"
+#include "processes.h"
+#include "pit.h"
+#endif
 
 /***************************************************************************************/
 /*                                                                                     */
@@ -24,133 +34,922 @@
 /*                                                                                     */
 /***************************************************************************************/
 
-// The threshold between what we will call a "small" block and a "big" block
-// Small blocks are placed in the beginning of the free linked list when they are freed
-//  and big blocks are placed at the end, which encourages small blocks to be allocated
-//  before fragmenting bigger ones
-#define BIG_BLOCK_THRESHOLD 2000
+// The heap is managed as a two-level segregated fit (TLSF) allocator
+// Free blocks are binned by size into a first level of power of two ranges, and each of those ranges
+//  is split linearly into SL_INDEX_COUNT second level bins. A pair of bitmaps records which bins
+//  are non-empty, so finding a suitable free block takes a constant number of bit scans no matter
+//  how fragmented the heap is, and every block stores a pointer to the block physically before it
+//  (a boundary tag) so that freed blocks are coalesced with their neighbours in constant time
+
+// The log2 of the number of second level bins in each first level range
+#define SL_INDEX_COUNT_LOG2 5
+#define SL_INDEX_COUNT (1 << SL_INDEX_COUNT_LOG2)
+// All block sizes (and therefore all block addresses) are multiples of BLOCK_ALIGNMENT
+#define BLOCK_ALIGNMENT_LOG2 3
+#define BLOCK_ALIGNMENT (1 << BLOCK_ALIGNMENT_LOG2)
+// Blocks smaller than SMALL_BLOCK_SIZE all share the first level bin 0, which is split linearly
+#define FL_INDEX_SHIFT (SL_INDEX_COUNT_LOG2 + BLOCK_ALIGNMENT_LOG2)
+#define SMALL_BLOCK_SIZE (1 << FL_INDEX_SHIFT)
+// The allocator can only track blocks smaller than 2^FL_INDEX_MAX bytes
+#define FL_INDEX_MAX 30
+#define FL_INDEX_COUNT (FL_INDEX_MAX - FL_INDEX_SHIFT + 1)
+
+// Allocations of at most SLAB_MAX_OBJECT_SIZE bytes are served by the slab layer, which keeps
+//  one free list per power of two size class so that small allocations never walk the free list
+// The smallest size class must be able to hold the pointer used to link free objects together
+#define SLAB_MIN_OBJECT_SIZE 16
+#define SLAB_MAX_OBJECT_SIZE 2048
+// The number of size classes (16, 32, 64, ..., 2048)
+#define NUM_SIZE_CLASSES 8
+// Each slab is a single 4KB page carved out of the heap, aligned to its own size so that
+//  the slab containing any object can be found by masking the object's address
+#define SLAB_SIZE NORMAL_PAGE_SIZE
+// The number of slab sized pages that the heap spans once it has grown to its largest size
+#define NUM_HEAP_SLABS (HEAP_MAX_SIZE / SLAB_SIZE)
+// The heap grows and shrinks in whole large pages
+#define HEAP_FRAME_SIZE LARGE_PAGE_SIZE
 
 // Memory descriptor
 // Struct which will be stored along with allocated memory that keeps track of heap structure
 typedef struct mem_desc {
 	// Bit field to save memory
 	struct {
-		// The size of the block in bytes (31 bits since we are not covering over half the entire RAM with a heap)
+		// The size of the block in bytes (30 bits since no block can be as large as 2^FL_INDEX_MAX bytes)
 		//  *including the descriptor*
-		unsigned int size: 31;
+		unsigned int size: 30;
+		// Whether the memory after the descriptor still has whatever was there at boot, in which case
+		//  it is cleared the first time the block is used (only ever set for free blocks)
+		unsigned int needs_clearing: 1;
 		// Whether or not this block is being used, boolean field
 		unsigned int is_free: 1; 
 	} block_data;
-	// Pointer to the next memory descriptor 
-	struct mem_desc *next, *prev;
-	// If this block is free, pointer to the next free node
+	// Pointer to the memory descriptor physically before this one (NULL for the first block)
+	// The block physically after this one is always found at (void*)this + size
+	struct mem_desc *prev;
+	// If this block is free, pointers to the neighbouring blocks in the same free list bin
 	struct mem_desc *next_free, *prev_free;
 } mem_desc;
 
+// The smallest block that can exist, which must be able to hold a descriptor
+#define MIN_BLOCK_SIZE ((sizeof(mem_desc) + BLOCK_ALIGNMENT - 1) & ~(BLOCK_ALIGNMENT - 1))
+
+// The first block in the heap, the last block in the heap and the address just past the last block
 static mem_desc *head = NULL;
-static mem_desc *free_head = NULL;
-static mem_desc *free_tail = NULL;
+static mem_desc *last_block = NULL;
+static void *heap_end = NULL;
+
+// Bit i is set if free_blocks[i] contains any non-empty bin
+static uint32_t fl_bitmap;
+// Bit j of sl_bitmap[i] is set if the bin free_blocks[i][j] is non-empty
+static uint32_t sl_bitmap[FL_INDEX_COUNT];
+// The heads of the free lists for each bin
+static mem_desc *free_blocks[FL_INDEX_COUNT][SL_INDEX_COUNT];
+
+// Counters that are kept up to date on every allocation and free for get_heap_stats
+static uint32_t bytes_in_use;
+static uint32_t peak_bytes_in_use;
+static uint32_t num_allocations;
+static uint32_t num_frees;
+static uint32_t num_failed_allocations;
+
+// Slab descriptor
+// Struct which keeps track of the objects of a single slab; it is stored outside the slab itself
+//  so that the entire page can be used for objects
+typedef struct slab_desc {
+	// Singly linked list of the free objects in this slab (the link is stored in the object itself)
+	void *free_objects;
+	// The number of objects in the slab that are free
+	uint16_t num_free;
+	// 1 + the index of the size class of this slab, or 0 if the page is not being used as a slab
+	uint8_t size_class;
+	// Pointers to the neighbouring slabs of the same size class that still have free objects
+	struct slab_desc *next, *prev;
+} slab_desc;
+
+// One descriptor for every slab sized page of the heap, indexed by (address - heap start) / SLAB_SIZE
+static slab_desc slabs[NUM_HEAP_SLABS];
+// For each size class, the head of the linked list of slabs that have at least one free object
+static slab_desc *partial_slabs[NUM_SIZE_CLASSES];
 
 struct spinlock_t heap_lock = SPIN_LOCK_UNLOCKED;
 
+#ifdef KHEAP_TRACE_ENABLE
+// The maximum number of calls that are recorded; once the trace is full, later calls are dropped
+//  rather than overwriting earlier ones, since a replay needs every call from the start of the trace
+#define HEAP_TRACE_MAX_RECORDS 16384
+// The length of one line of the trace file, "A SSSSSSSS AAAAAAAA PPPPPPPP\n" (see kheap.h)
+#define HEAP_TRACE_LINE_LENGTH 29
+
+// A single recorded call to kmalloc, kmalloc_aligned, krealloc or kfree
+typedef struct heap_trace_record {
+	// HEAP_TRACE_ALLOC, HEAP_TRACE_REALLOC or HEAP_TRACE_FREE
+	int8_t op;
+	// The requested size and alignment (0 for kmalloc, or the pointer passed to krealloc),
+	//  or 0 for a free
+	uint32_t size;
+	uint32_t alignment;
+	// The pointer that was returned (NULL if the allocation failed) or freed
+	void *ptr;
+} heap_trace_record;
+
+static heap_trace_record trace_records[HEAP_TRACE_MAX_RECORDS];
+static uint32_t num_trace_records;
+static uint32_t num_dropped_trace_records;
+
+/*
+ * Appends a call to the trace if there is room left for it
+ * heap_lock must be held when calling this function
+ */
+static void record_trace(int8_t op, uint32_t size, uint32_t alignment, void *ptr) {
+	if (num_trace_records == HEAP_TRACE_MAX_RECORDS) {
+		num_dropped_trace_records++;
+		return;
+	}
+
+	trace_records[num_trace_records].op = op;
+	trace_records[num_trace_records].size = size;
+	trace_records[num_trace_records].alignment = alignment;
+	trace_records[num_trace_records].ptr = ptr;
+	num_trace_records++;
+}
+
+	#define HEAP_TRACE(op, size, alignment, ptr) record_trace(op, size, alignment, ptr)
+#else
+	#define HEAP_TRACE(op, size, alignment, ptr) // Nothing
+#endif
+
+#ifdef KHEAP_PROFILE_ENABLE
+// The number of call sites that are tracked separately; allocations from any further call sites
+//  are counted together under a call site of NULL
+#define HEAP_PROFILE_MAX_SITES 64
+// The number of call sites listed in each table of the report
+#define HEAP_PROFILE_REPORT_SITES 16
+// The maximum length of the entry for one call site in the report
+#define HEAP_PROFILE_ENTRY_LENGTH 160
+// Tag stored directly in front of every buffer returned by kmalloc while profiling
+typedef struct heap_profile_tag {
+	// The site that the buffer is accounted to
+	struct heap_profile_site *site;
+	// The time the buffer was allocated, in milliseconds since startup
+	uint32_t timestamp;
+	// The size requested by the caller
+	uint32_t size;
+	// The distance from the start of the underlying allocation to the buffer
+	uint32_t offset;
+} heap_profile_tag;
+
+// The space left for the tag in front of every buffer, rounded up to keep buffers 16 byte aligned
+#define HEAP_PROFILE_TAG_SIZE ((sizeof(heap_profile_tag) + 15) & ~15)
+
+// The statistics for all the allocations made from a single call site
+typedef struct heap_profile_site {
+	// The return address of the call to kmalloc / kmalloc_aligned
+	void *call_site;
+	// The bytes requested and the number of buffers that have not been freed yet
+	uint32_t live_bytes;
+	uint32_t live_blocks;
+	// The number of allocations and frees made since the first allocation
+	uint32_t num_allocations;
+	uint32_t num_frees;
+	// The time of the first allocation, in milliseconds since startup
+	uint32_t first_allocation;
+	// The sum of the lifetimes of all freed buffers, in milliseconds
+	uint32_t total_lifetime;
+} heap_profile_site;
+
+static heap_profile_site profile_sites[HEAP_PROFILE_MAX_SITES];
+static uint32_t num_profile_sites;
+
+/*
+ * Returns the current time in milliseconds since startup
+ */
+static uint32_t get_profile_time() {
+	uint32_t ticks = sys_time;
+	return (ticks / PIT_FREQUENCY) * 1000 + (ticks % PIT_FREQUENCY) * 1000 / PIT_FREQUENCY;
+}
+
+/*
+ * Tags a newly allocated buffer with its call site and allocation time, and adds it to the
+ *  statistics of its call site
+ * heap_lock must be held when calling this function
+ *
+ * INPUTS: block: the start of the allocation, which is offset bytes larger than requested
+ *         size: the size requested by the caller
+ *         offset: the distance from the start of the allocation to the buffer given to the caller,
+ *                 which is at least HEAP_PROFILE_TAG_SIZE
+ *         call_site: the return address of the call to kmalloc / kmalloc_aligned
+ * OUTPUTS: the buffer to give to the caller
+ */
+static void* tag_allocation(void *block, uint32_t size, uint32_t offset, void *call_site) {
+	uint32_t now = get_profile_time();
+
+	// Find the call site, adding it if it is new and falling back to the last site when full
+	heap_profile_site *site;
+	for (site = profile_sites; site < &profile_sites[num_profile_sites]; site++) {
+		if (site->call_site == call_site)
+			break;
+	}
+	if (site == &profile_sites[num_profile_sites]) {
+		if (num_profile_sites == HEAP_PROFILE_MAX_SITES) {
+			site = &profile_sites[HEAP_PROFILE_MAX_SITES - 1];
+			site->call_site = NULL;
+		} else {
+			num_profile_sites++;
+			site->call_site = call_site;
+			site->first_allocation = now;
+		}
+	}
+
+	site->live_bytes += size;
+	site->live_blocks++;
+	site->num_allocations++;
+
+	heap_profile_tag *tag = (heap_profile_tag*)(block + offset) - 1;
+	tag->site = site;
+	tag->timestamp = now;
+	tag->size = size;
+	tag->offset = offset;
+
+	return block + offset;
+}
+
+/*
+ * Removes a buffer being freed from the statistics of its call site
+ * heap_lock must be held when calling this function
+ *
+ * INPUTS: ptr: a buffer returned by tag_allocation
+ * OUTPUTS: the start of the underlying allocation
+ */
+static void* untag_allocation(void *ptr) {
+	heap_profile_tag *tag = (heap_profile_tag*)ptr - 1;
+	heap_profile_site *site = tag->site;
+
+	site->live_bytes -= tag->size;
+	site->live_blocks--;
+	site->num_frees++;
+	site->total_lifetime += get_profile_time() - tag->timestamp;
+
+	return ptr - tag->offset;
+}
+#endif
+
+/*
+ * Finds the index of the most significant set bit of a non-zero value
+ */
+static inline int find_last_set(uint32_t value) {
+	int index;
+	asm ("bsrl %1, %0" : "=r"(index) : "rm"(value) : "cc");
+	return index;
+}
+
+/*
+ * Finds the index of the least significant set bit of a non-zero value
+ */
+static inline int find_first_set(uint32_t value) {
+	int index;
+	asm ("bsfl %1, %0" : "=r"(index) : "rm"(value) : "cc");
+	return index;
+}
+
+/*
+ * Computes the bin that a free block of the given size belongs in
+ *
+ * INPUTS: size: the size of the block, including the descriptor
+ * OUTPUTS: fl, sl: filled in with the first and second level indices of the bin
+ */
+static inline void mapping_insert(uint32_t size, int *fl, int *sl) {
+	if (size < SMALL_BLOCK_SIZE) {
+		// Small blocks are split linearly into bins of BLOCK_ALIGNMENT bytes
+		*fl = 0;
+		*sl = size / (SMALL_BLOCK_SIZE / SL_INDEX_COUNT);
+	} else {
+		// The first level is given by the most significant bit and the second level
+		//  by the SL_INDEX_COUNT_LOG2 bits that follow it
+		int msb = find_last_set(size);
+		*sl = (size >> (msb - SL_INDEX_COUNT_LOG2)) ^ SL_INDEX_COUNT;
+		*fl = msb - FL_INDEX_SHIFT + 1;
+	}
+}
+
+/*
+ * Rounds a block size up to the smallest size that maps to a bin in which every free block is at
+ *  least the original size
+ */
+static inline uint32_t round_up_to_bin(uint32_t size) {
+	if (size >= SMALL_BLOCK_SIZE)
+		size += (1 << (find_last_set(size) - SL_INDEX_COUNT_LOG2)) - 1;
+	return size;
+}
+
+/*
+ * Computes the first bin in which every free block is at least the given size, so that any block
+ *  found there (or in a larger bin) can satisfy the request without searching the list
+ *
+ * INPUTS: size: the size of the desired block, including the descriptor
+ * OUTPUTS: fl, sl: filled in with the first and second level indices of the bin
+ */
+static inline void mapping_search(uint32_t size, int *fl, int *sl) {
+	mapping_insert(round_up_to_bin(size), fl, sl);
+}
+
+/*
+ * Inserts the provided block at the head of the free list bin for its size
+ */
+static void insert_free_block(mem_desc *block) {
+	int fl, sl;
+	mapping_insert(block->block_data.size, &fl, &sl);
+
+	block->prev_free = NULL;
+	block->next_free = free_blocks[fl][sl];
+	(block->next_free == NULL) ? (0) : (block->next_free->prev_free = block);
+	free_blocks[fl][sl] = block;
+
+	// Mark the bin as non-empty
+	fl_bitmap |= 1U << fl;
+	sl_bitmap[fl] |= 1U << sl;
+}
+
+/*
+ * Removes the provided mem_desc from the free list bin that it is in
+ */
+static void remove_free_block(mem_desc *block) {
+	int fl, sl;
+	mapping_insert(block->block_data.size, &fl, &sl);
+
+	(block->prev_free == NULL) ? (free_blocks[fl][sl] = block->next_free) :
+	                             (block->prev_free->next_free = block->next_free);
+	(block->next_free == NULL) ? (0) : (block->next_free->prev_free = block->prev_free);
+
+	// Mark the bin as empty if this was the last block in it
+	if (free_blocks[fl][sl] == NULL) {
+		sl_bitmap[fl] &= ~(1U << sl);
+		if (sl_bitmap[fl] == 0)
+			fl_bitmap &= ~(1U << fl);
+	}
+}
+
+/*
+ * Finds a free block of at least the given size and removes it from its free list
+ *
+ * INPUTS: size: the size of the desired block, including the descriptor
+ * OUTPUTS: a free block of at least the given size, or NULL if there is none
+ */
+static mem_desc* find_free_block(uint32_t size) {
+	int fl, sl;
+	mapping_search(size, &fl, &sl);
+	if (fl >= FL_INDEX_COUNT)
+		return NULL;
+
+	// Look for a non-empty bin at or above sl in the same first level range
+	uint32_t sl_map = sl_bitmap[fl] & (~0U << sl);
+	if (sl_map == 0) {
+		// Otherwise, take the smallest non-empty bin from a larger first level range
+		// The shift is split in two since shifting a 32-bit value by 32 is undefined
+		uint32_t fl_map = fl_bitmap & ((~0U << fl) << 1);
+		if (fl_map == 0)
+			return NULL;
+
+		fl = find_first_set(fl_map);
+		sl_map = sl_bitmap[fl];
+	}
+	sl = find_first_set(sl_map);
+
+	mem_desc *block = free_blocks[fl][sl];
+	remove_free_block(block);
+	return block;
+}
+
+/*
+ * Gets the block that is physically after the provided one
+ *
+ * OUTPUTS: the next block, or NULL if the provided block is the last in the heap
+ */
+static inline mem_desc* next_block(mem_desc *block) {
+	void *next = (void*)block + block->block_data.size;
+	return (next == heap_end) ? NULL : (mem_desc*)next;
+}
+
+/*
+ * Splits the provided block into two blocks, where the first block has the provided size, and
+ *  inserts the second block into the free lists
+ * Nothing is done if the remainder would be too small to form a block of its own
+ *
+ * INPUTS: block: the block to split, which must not be in any free list
+ *         size: the size of the first block in the resulting split (including descriptor)
+ */
+static void trim_block(mem_desc *block, uint32_t size) {
+	if (block->block_data.size < size + MIN_BLOCK_SIZE)
+		return;
+
+	// Create the second block with the rest of the space
+	mem_desc *remainder = (mem_desc*)((void*)block + size);
+	remainder->block_data.size = block->block_data.size - size;
+	remainder->block_data.needs_clearing = block->block_data.needs_clearing;
+	remainder->block_data.is_free = 1;
+	remainder->prev = block;
+	block->block_data.size = size;
+
+	// Update the boundary tag of the block after the remainder
+	mem_desc *next = next_block(remainder);
+	(next == NULL) ? (last_block = remainder) : (next->prev = remainder);
+
+	insert_free_block(remainder);
+}
+
+/*
+ * Merges the provided block with the block physically after it, which must be free and has
+ *  already been removed from its free list
+ */
+static void merge_next_block(mem_desc *block, mem_desc *next) {
+	block->block_data.size += next->block_data.size;
+	block->block_data.needs_clearing |= next->block_data.needs_clearing;
+
+	mem_desc *after = next_block(block);
+	(after == NULL) ? (last_block = block) : (after->prev = block);
+}
+
 /*
- * Clears the entire heap, fills it with zeroes, and initializes values
+ * Converts a requested number of bytes into the size of the block needed to hold them
+ */
+static inline uint32_t get_block_size(uint32_t size) {
+	uint32_t block_size = (size + sizeof(mem_desc) + BLOCK_ALIGNMENT - 1) & ~(BLOCK_ALIGNMENT - 1);
+	return (block_size < MIN_BLOCK_SIZE) ? MIN_BLOCK_SIZE : block_size;
+}
+
+/*
+ * Marks the provided block as used and records it in the heap statistics, clearing it first if it
+ *  has not been cleared since boot
+ */
+static inline void mark_block_used(mem_desc *block) {
+	if (block->block_data.needs_clearing) {
+		memset((void*)block + sizeof(mem_desc), 0, block->block_data.size - sizeof(mem_desc));
+		block->block_data.needs_clearing = 0;
+	}
+	block->block_data.is_free = 0;
+
+	bytes_in_use += block->block_data.size;
+	if (bytes_in_use > peak_bytes_in_use)
+		peak_bytes_in_use = bytes_in_use;
+}
+
+#ifndef KHEAP_HOSTED
+/*
+ * Claims the large page at the given address and maps it in so that the heap can grow into it
+ * The heap is identity mapped like the rest of the kernel, since devices are given heap buffers
+ *
+ * INPUTS: addr: the 4MB aligned address of the page, which is the current end of the heap
+ * OUTPUTS: 0 on success and -1 if the page is being used for something else
+ */
+static int32_t claim_heap_frame(void *addr) {
+	if (claim_page((uint32_t)addr / LARGE_PAGE_SIZE) != 0)
+		return -1;
+
+	map_region(addr, addr, 1, PAGE_GLOBAL | PAGE_READ_WRITE);
+	return 0;
+}
+
+/*
+ * Unmaps a large page previously claimed by claim_heap_frame and makes it available to the rest
+ *  of the kernel again
+ */
+static void release_heap_frame(void *addr) {
+	unmap_region(addr, 1);
+	free_page((uint32_t)addr / LARGE_PAGE_SIZE);
+}
+#endif
+
+/*
+ * Extends the end of the heap by enough large pages that a free block of the given size exists
+ * The new pages are merged into the last block if it is free
+ * heap_lock must be held when calling this function
+ *
+ * INPUTS: size: the size of the block that is needed, including the descriptor
+ * OUTPUTS: 0 on success and -1 if the heap cannot grow that far
+ */
+static int32_t grow_heap(uint32_t size) {
+	// The block must be big enough to be found when searching for the given size
+	size = round_up_to_bin(size);
+	uint32_t available = last_block->block_data.is_free ? last_block->block_data.size : 0;
+	uint32_t growth = (size - available + HEAP_FRAME_SIZE - 1) / HEAP_FRAME_SIZE * HEAP_FRAME_SIZE;
+
+	if (growth > KERNEL_HEAP_MAX_ADDR - (uint32_t)heap_end)
+		return -1;
+
+	// Claim all the pages, giving them all back if any of them are not available
+	uint32_t offset;
+	for (offset = 0; offset < growth; offset += HEAP_FRAME_SIZE) {
+		if (claim_heap_frame(heap_end + offset) != 0) {
+			while (offset > 0) {
+				offset -= HEAP_FRAME_SIZE;
+				release_heap_frame(heap_end + offset);
+			}
+			return -1;
+		}
+	}
+
+	// Create a block out of the new pages at the end of the heap
+	mem_desc *block = (mem_desc*)heap_end;
+	block->block_data.size = growth;
+	block->block_data.needs_clearing = 0;
+	block->block_data.is_free = 1;
+	block->prev = last_block;
+	last_block = block;
+	heap_end += growth;
+
+	// Merge it into the block before it if possible, which keeps the last block as one piece
+	if (block->prev->block_data.is_free) {
+		mem_desc *prev = block->prev;
+		remove_free_block(prev);
+		merge_next_block(prev, block);
+		block = prev;
+	}
+
+	insert_free_block(block);
+	return 0;
+}
+
+/*
+ * Gives back the large pages at the end of the heap that are entirely covered by the last block if
+ *  it is free, keeping one of them around so that allocations that repeatedly cross a page boundary
+ *  do not claim and release the same page over and over
+ * The heap never shrinks below its original size
+ * heap_lock must be held when calling this function
+ */
+static void shrink_heap() {
+	if (!last_block->block_data.is_free)
+		return;
+
+	// Keep the part of the last block that shares a page with allocated memory, and one more page
+	uint32_t used = (uint32_t)last_block + MIN_BLOCK_SIZE - KERNEL_HEAP_START_ADDR;
+	void *new_end = (void*)KERNEL_HEAP_START_ADDR +
+		(used + HEAP_FRAME_SIZE - 1) / HEAP_FRAME_SIZE * HEAP_FRAME_SIZE + HEAP_FRAME_SIZE;
+	if (new_end < (void*)KERNEL_HEAP_END_ADDR)
+		new_end = (void*)KERNEL_HEAP_END_ADDR;
+	if (new_end >= heap_end)
+		return;
+
+	remove_free_block(last_block);
+	last_block->block_data.size -= heap_end - new_end;
+	insert_free_block(last_block);
+
+	while (heap_end > new_end) {
+		heap_end -= HEAP_FRAME_SIZE;
+		release_heap_frame(heap_end);
+	}
+}
+
+/*
+ * Allocates a block of the specified size from the free lists
+ * heap_lock must be held when calling this function
+ *
+ * INPUTS: size: the size of the buffer to allocate
+ * OUTPUTS: a pointer to a buffer of specified size, or NULL if none could be found
+ */
+static void* block_alloc(uint32_t size) {
+	// Reject sizes which would overflow when the descriptor is added
+	if (size > HEAP_MAX_SIZE)
+		return NULL;
+
+	uint32_t block_size = get_block_size(size);
+
+	// Grow the heap if there is no block big enough
+	mem_desc *block = find_free_block(block_size);
+	if (block == NULL && grow_heap(block_size) == 0)
+		block = find_free_block(block_size);
+	if (block == NULL)
+		return NULL;
+
+	// Give back whatever is not needed and mark the block as used
+	trim_block(block, block_size);
+	mark_block_used(block);
+
+	return (void*)block + sizeof(mem_desc);
+}
+
+/*
+ * Allocates a block of the specified size that is aligned to a multiple of the parameter alignment
+ *  from the free lists
+ * heap_lock must be held when calling this function
+ *
+ * INPUTS: size: the size of the buffer to allocate
+ *         alignment: the returned pointer will be a multiple of this value, which must be a power of two
+ * OUTPUTS: a pointer to an aligned buffer of the specified size, or NULL if none could be found
+ */
+static void* block_alloc_aligned(uint32_t size, uint32_t alignment) {
+	// Every block is already aligned to BLOCK_ALIGNMENT
+	if (alignment <= BLOCK_ALIGNMENT)
+		return block_alloc(size);
+
+	// Reject sizes which would overflow when the padding is added
+	if (size > HEAP_MAX_SIZE || alignment > HEAP_MAX_SIZE)
+		return NULL;
+
+	uint32_t block_size = get_block_size(size);
+
+	// Find a block that is big enough to be aligned even in the worst case, in which the gap
+	//  before the aligned address is just short of a full alignment plus enough room for the
+	//  gap to become a free block of its own
+	mem_desc *block = find_free_block(block_size + alignment + MIN_BLOCK_SIZE);
+	if (block == NULL && grow_heap(block_size + alignment + MIN_BLOCK_SIZE) == 0)
+		block = find_free_block(block_size + alignment + MIN_BLOCK_SIZE);
+	if (block == NULL)
+		return NULL;
+
+	// Currently, we have
+	//  [ mem_desc | (...) ]
+	//             ^
+	//             start
+	// and we want
+	//  [ mem_desc | (...) | mem_desc | size bytes | (...) ]
+	//                                ^
+	//                                aligned
+	// where the first block (if it exists) becomes free again
+	uint32_t start = (uint32_t)block + sizeof(mem_desc);
+	uint32_t aligned = (start + alignment - 1) & ~(alignment - 1);
+	// The gap must either not exist or be big enough to form a block
+	while (aligned != start && aligned - start < MIN_BLOCK_SIZE)
+		aligned += alignment;
+
+	if (aligned != start) {
+		// Split the gap off into its own block and return it to the free lists
+		mem_desc *aligned_block = (mem_desc*)(aligned - sizeof(mem_desc));
+		aligned_block->block_data.size = block->block_data.size - (aligned - start);
+		aligned_block->block_data.needs_clearing = block->block_data.needs_clearing;
+		aligned_block->prev = block;
+		block->block_data.size = aligned - start;
+
+		mem_desc *next = next_block(aligned_block);
+		(next == NULL) ? (last_block = aligned_block) : (next->prev = aligned_block);
+
+		insert_free_block(block);
+		block = aligned_block;
+	}
+
+	// Give back whatever is not needed at the end and mark the block as used
+	trim_block(block, block_size);
+	mark_block_used(block);
+
+	return (void*)block + sizeof(mem_desc);
+}
+
+/*
+ * Returns a block previously returned by block_alloc or block_alloc_aligned to the free lists
+ *  after coalescing it with any neighbouring free blocks
+ * heap_lock must be held when calling this function
+ *
+ * INPUTS: ptr: a pointer previously returned by block_alloc or block_alloc_aligned
+ */
+static void block_free(void* ptr) {
+	// Get memory descriptor corresponding to this pointer and mark it free
+	mem_desc *block = (mem_desc*)((void*)ptr - sizeof(mem_desc));
+	block->block_data.is_free = 1;
+	bytes_in_use -= block->block_data.size;
+
+	// Coalesce with the block after this one if it is free
+	mem_desc *next = next_block(block);
+	if (next != NULL && next->block_data.is_free) {
+		remove_free_block(next);
+		merge_next_block(block, next);
+	}
+
+	// Coalesce with the block before this one if it is free
+	mem_desc *prev = block->prev;
+	if (prev != NULL && prev->block_data.is_free) {
+		remove_free_block(prev);
+		merge_next_block(prev, block);
+		block = prev;
+	}
+
+	insert_free_block(block);
+
+	// Return any whole pages at the end of the heap that are no longer needed
+	if (block == last_block)
+		shrink_heap();
+}
+
+/*
+ * Resizes a block returned by block_alloc without moving it, either by giving back the end of the
+ *  block or by extending it into the free block physically after it
+ * heap_lock must be held when calling this function
+ *
+ * INPUTS: ptr: a pointer previously returned by block_alloc
+ *         size: the new size of the buffer
+ * OUTPUTS: 1 if the block was resized and 0 if it has to be moved
+ */
+static int block_resize(void *ptr, uint32_t size) {
+	if (size > HEAP_MAX_SIZE)
+		return 0;
+
+	mem_desc *block = (mem_desc*)(ptr - sizeof(mem_desc));
+	mem_desc *next = next_block(block);
+	uint32_t block_size = get_block_size(size);
+	uint32_t next_size = (next != NULL && next->block_data.is_free) ? next->block_data.size : 0;
+
+	if (block->block_data.size + next_size < block_size)
+		return 0;
+
+	// Take over the free block after this one so that whatever is left over after the resize
+	//  is returned to the free lists as a single block
+	bytes_in_use -= block->block_data.size;
+	if (next_size != 0) {
+		remove_free_block(next);
+		merge_next_block(block, next);
+
+		// The block is in use, so only the part that it grew into can be cleared
+		if (block->block_data.needs_clearing) {
+			memset(next, 0, next_size);
+			block->block_data.needs_clearing = 0;
+		}
+	}
+
+	trim_block(block, block_size);
+	mark_block_used(block);
+
+	// The leftover space may have made whole pages at the end of the heap free
+	shrink_heap();
+	return 1;
+}
+
+/*
+ * Sets up the heap as a single free block and initializes values
  */
 void init_kheap() {
 	spin_lock_irqsave(heap_lock);
 
-	// Fill the heap with zeroes
-	int i;
-	uint32_t *heap_base = (uint32_t*)KERNEL_HEAP_START_ADDR;
-	for (i = 0; i < HEAP_SIZE / 4; i++) {
-		heap_base[i] = 0;
+	int i, j;
+
+	// Empty all the free list bins
+	fl_bitmap = 0;
+	for (i = 0; i < FL_INDEX_COUNT; i++) {
+		sl_bitmap[i] = 0;
+		for (j = 0; j < SL_INDEX_COUNT; j++)
+			free_blocks[i][j] = NULL;
 	}
 
-	// Set all the heads and tails to point to the singular block starting at the beginning
-	head = (mem_desc*)KERNEL_HEAP_START_ADDR;
-	free_head = (mem_desc*)KERNEL_HEAP_START_ADDR;
-	free_tail = (mem_desc*)KERNEL_HEAP_START_ADDR;
+	// Reset the statistics
+	bytes_in_use = 0;
+	peak_bytes_in_use = 0;
+	num_allocations = 0;
+	num_frees = 0;
+	num_failed_allocations = 0;
 
-	// Set the single block to be free and contain the whole heap
-	head->block_data.size = HEAP_SIZE & 0x7FFFFFFF;
+	// Create a single free block that contains the whole heap
+	head = (mem_desc*)KERNEL_HEAP_START_ADDR;
+	last_block = head;
+	heap_end = (void*)KERNEL_HEAP_END_ADDR;
+	// The heap is filled with zeroes lazily, as each part of it is used for the first time (pages
+	//  that the heap grows into later are not cleared)
+	head->block_data.size = HEAP_SIZE;
+	head->block_data.needs_clearing = 1;
 	head->block_data.is_free = 1;
-	head->next = NULL;
 	head->prev = NULL;
-	head->next_free = NULL;
-	head->prev_free = NULL;
+	insert_free_block(head);
+
+	// No pages are being used as slabs yet
+	for (i = 0; i < NUM_HEAP_SLABS; i++)
+		slabs[i].size_class = 0;
+	for (i = 0; i < NUM_SIZE_CLASSES; i++)
+		partial_slabs[i] = NULL;
 
 	spin_unlock_irqsave(heap_lock);
 }
 
 /*
- * Removes the provided mem_desc from the free linked list
+ * Gets the index of the smallest size class whose objects can hold the given number of bytes
+ *
+ * INPUTS: size: the size of the desired allocation, which must be at most SLAB_MAX_OBJECT_SIZE
+ * OUTPUTS: the index of the size class, where size class i holds objects of SLAB_MIN_OBJECT_SIZE << i bytes
  */
-void remove_free_element(mem_desc *cur) {
-	// Set prev->next and next->prev pointers to remove cur from the free list
-	if (free_head == cur)
-		free_head = cur->next_free;
-	else
-		cur->prev_free->next_free = cur->next_free;
+static inline int get_size_class(uint32_t size) {
+	int size_class = 0;
+	while ((SLAB_MIN_OBJECT_SIZE << size_class) < size)
+		size_class++;
+	return size_class;
+}
 
-	if (free_tail == cur)
-		free_tail = cur->prev_free;
-	else
-		cur->next_free->prev_free = cur->prev_free;
+/*
+ * Gets the descriptor of the slab that contains the given pointer
+ *
+ * INPUTS: ptr: any pointer into the kernel heap
+ * OUTPUTS: the descriptor of the slab sized page containing ptr (which may not actually be a slab)
+ */
+static inline slab_desc* get_slab(void *ptr) {
+	return &slabs[((uint32_t)ptr - KERNEL_HEAP_START_ADDR) / SLAB_SIZE];
 }
 
 /*
- * Splits the provided free block into two blocks, where the first block has provided size 
+ * Gets the address of the page described by the provided slab descriptor
+ */
+static inline void* get_slab_addr(slab_desc *slab) {
+	return (void*)(KERNEL_HEAP_START_ADDR + (slab - slabs) * SLAB_SIZE);
+}
+
+/*
+ * Removes the provided slab from the list of slabs of its size class that have free objects
+ */
+static void remove_partial_slab(slab_desc *slab) {
+	int size_class = slab->size_class - 1;
+
+	(slab->prev == NULL) ? (partial_slabs[size_class] = slab->next) : (slab->prev->next = slab->next);
+	(slab->next == NULL) ? (0) : (slab->next->prev = slab->prev);
+}
+
+/*
+ * Inserts the provided slab at the head of the list of slabs of its size class that have free objects
+ */
+static void insert_partial_slab(slab_desc *slab) {
+	int size_class = slab->size_class - 1;
+
+	slab->prev = NULL;
+	slab->next = partial_slabs[size_class];
+	(slab->next == NULL) ? (0) : (slab->next->prev = slab);
+	partial_slabs[size_class] = slab;
+}
+
+/*
+ * Carves a new slab for the given size class out of the block allocator and links all its objects
+ *  into the slab's free list
+ * heap_lock must be held when calling this function
  *
- * INPUTS: cur: the block to split
- *         size: the size of the first block in the resulting split (excluding descriptor)
- * OUTPUTS: NULL if the block is not free or if the size is invalid, address of second block in split otherwise
+ * INPUTS: size_class: the index of the size class that the slab will hold
+ * OUTPUTS: the descriptor of the new slab, or NULL if the heap is full
  */
-mem_desc* split_free_block(mem_desc *cur, uint32_t size) {
-	// Check that the size is valid
-	if (size + 2 * sizeof(mem_desc) > cur->block_data.size)
+static slab_desc* create_slab(int size_class) {
+	void *page = block_alloc_aligned(SLAB_SIZE, SLAB_SIZE);
+	if (page == NULL)
 		return NULL;
 
-	// Check that the block is free
-	if (!cur->block_data.is_free)
-		return NULL;
+	slab_desc *slab = get_slab(page);
+	uint32_t object_size = SLAB_MIN_OBJECT_SIZE << size_class;
 
-	uint32_t total_size = cur->block_data.size;
-
-	// Update the size of the first block
-	cur->block_data.size = size + sizeof(mem_desc); 
-
-	// Get a pointer to the address of the new block
-	mem_desc *new_block = (mem_desc*)((void*)cur + size + sizeof(mem_desc));
-	// Mark it free
-	new_block->block_data.is_free = 1;
-	// Set the size of the second block to be 
-	//  total original size - size of first block's data - size of first block's descriptor
-	new_block->block_data.size = total_size - size - sizeof(mem_desc);
-
-	// Update all pointers in the regular blocks array, inserting new_block in correct memory order
-	new_block->next = cur->next;
-	new_block->prev = cur;
-	cur->next = new_block;
-	(new_block->next == NULL) ? (0) : (new_block->next->prev = new_block);
-
-	// Update all pointers in the free blocks array, inserting new_block at the tail of the free array
-	// Insert the new block at the head if it is small and at the tail if it is big
-	// The intent of this is to prevent fragmentation by trying to use small blocks before big ones
-	if (new_block->block_data.size > BIG_BLOCK_THRESHOLD) {
-		// Put the block at the end of the linked list
-		new_block->next_free = NULL;
-		new_block->prev_free = free_tail;
-		(free_tail == NULL) ? (free_head = new_block) : (free_tail->next_free = new_block);
-		free_tail = new_block;
-	} else {
-		// Put the block at the beginning of the linked list
-		new_block->prev_free = NULL;
-		new_block->next_free = free_head;
-		(free_head == NULL) ? (free_tail = new_block) : (free_head->prev_free = new_block);
-		free_head = new_block;
+	// Thread the free list through the objects, in increasing order of address
+	uint32_t offset;
+	slab->free_objects = NULL;
+	for (offset = SLAB_SIZE; offset >= object_size; offset -= object_size) {
+		void *object = page + offset - object_size;
+		*(void**)object = slab->free_objects;
+		slab->free_objects = object;
 	}
 
-	return new_block;
+	slab->num_free = SLAB_SIZE / object_size;
+	slab->size_class = size_class + 1;
+	insert_partial_slab(slab);
+
+	return slab;
+}
+
+/*
+ * Allocates an object from the slabs of the given size class, creating a new slab if necessary
+ * heap_lock must be held when calling this function
+ *
+ * INPUTS: size_class: the index of the size class to allocate from
+ * OUTPUTS: a pointer to an object of SLAB_MIN_OBJECT_SIZE << size_class bytes, or NULL if the heap is full
+ */
+static void* slab_alloc(int size_class) {
+	slab_desc *slab = partial_slabs[size_class];
+	if (slab == NULL && (slab = create_slab(size_class)) == NULL)
+		return NULL;
+
+	// Pop the first object off the slab's free list
+	void *object = slab->free_objects;
+	slab->free_objects = *(void**)object;
+	slab->num_free--;
+
+	// A full slab does not belong in the list of slabs with free objects
+	if (slab->num_free == 0)
+		remove_partial_slab(slab);
+
+	return object;
+}
+
+/*
+ * Returns an object to the slab that it was allocated from
+ * If this empties the slab and the size class has other slabs with free objects, the slab's page
+ *  is returned to the block allocator; otherwise it is kept around so that alternating allocations
+ *  and frees do not repeatedly create and destroy the same slab
+ * heap_lock must be held when calling this function
+ *
+ * INPUTS: slab: the slab containing the object
+ *         ptr: a pointer previously returned by slab_alloc
+ */
+static void slab_free(slab_desc *slab, void *ptr) {
+	uint32_t objects_per_slab = SLAB_SIZE / (SLAB_MIN_OBJECT_SIZE << (slab->size_class - 1));
+
+	// Push the object onto the slab's free list
+	*(void**)ptr = slab->free_objects;
+	slab->free_objects = ptr;
+	slab->num_free++;
+
+	// If the slab was full, it now has a free object again
+	if (slab->num_free == 1)
+		insert_partial_slab(slab);
+
+	// Release the slab if it is empty and it is not the only slab left with free objects
+	if (slab->num_free == objects_per_slab && (slab->prev != NULL || slab->next != NULL)) {
+		remove_partial_slab(slab);
+		slab->size_class = 0;
+		block_free(get_slab_addr(slab));
+	}
 }
 
 /*
@@ -161,82 +960,41 @@ mem_desc* split_free_block(mem_desc *cur, uint32_t size) {
  * OUTPUTS: a pointer to an aligned buffer of the specified size
  */
 void* kmalloc_aligned(uint32_t size, uint32_t alignment) {
+	void *ptr;
+
+#ifdef KHEAP_PROFILE_ENABLE
+	// Make room for the tag while keeping the buffer aligned
+	uint32_t requested_size = size;
+	uint32_t tag_offset = (alignment > HEAP_PROFILE_TAG_SIZE) ? alignment : HEAP_PROFILE_TAG_SIZE;
+	if (size <= HEAP_MAX_SIZE)
+		size += tag_offset;
+#endif
+
 	spin_lock_irqsave(heap_lock);
 
-	// Look through all the free blocks
-	mem_desc *cur;
-	for (cur = free_head; cur != NULL; cur = cur->next_free) {
-		// [start, end): bounds on the actual region of allocatable memory given by this block
-		uint32_t start = (uint32_t)cur + sizeof(mem_desc);
-		uint32_t end = (uint32_t)cur + cur->block_data.size;
-
-		// The block contains an aligned address if
-		//   start = alignment * m OR
-		//   start = alignment * m + j and end = alignment * n + k for n > m, k < alignment, j < alignment
-		// The two following if statements check for these two cases, respectively
-		if (start % alignment == 0) {
-			// In this case, we either have exactly the right size, 
-			//  or we can split into two blocks and reserve the first
-			if (cur->block_data.size == size + sizeof(mem_desc) ||
-				split_free_block(cur, size) != NULL) {
-				
-				// Then, simply mark the block as not free and remove it from the free list
-				cur->block_data.is_free = 0;
-				remove_free_element(cur);
-
-				// Return the corresponding pointer
-				spin_unlock_irqsave(heap_lock);
-				return (void*)cur + sizeof(mem_desc);
-			}
-		} else if (start / alignment != end / alignment) {
-			// In this case, the buffer should start from alignment * (start / alignment + 1)
-			//  which is basically start rounded up to the closest multiple of alignment
-			uint32_t actual_start = alignment * (start / alignment + 1);
-
-			// Currently, we have
-			//  [ mem_desc | (...) ]
-			//             ^
-			//             start
-			// where ... indicates some unknown number of bytes and () means optional. We want 
-			//  [ mem_desc | (...) | mem_desc | size bytes | (mem_desc) | (...) ]
-			//             ^                  ^
-			//             start              actual_start
-
-			// Let's check if we have enough room to fit all these things
-			// First check: the space between start and actual_start can fit a mem_desc
-			if (actual_start - start < sizeof(mem_desc))
-				continue;
-			// Second check: either the first and second block fully fill the entire area
-			//               or the third block does exist, and there is enough room for its mem_desc
-			int enough_room = (sizeof(mem_desc) + (actual_start - start) + size == cur->block_data.size) ||
-			                  (2 * sizeof(mem_desc) + (actual_start - start) + size <= cur->block_data.size);
-			if (!enough_room)
-				continue;
-
-			// Note down whether or not we will have to create a third block (ie, the first and second DON'T
-			//  fully fill the original block)
-			int third_block = !(sizeof(mem_desc) + (actual_start - start) + size == cur->block_data.size);
-
-			// Perform the first split, such that the first piece has data size indicated in the diagram
-			mem_desc *second_block = split_free_block(cur, actual_start - start - sizeof(mem_desc));
-		
-			// Then, perform an additional split if a third block needs to be created
-			if (third_block)
-				split_free_block(second_block, size);
-		
-			// Mark the second block (the aligned one with the desired size) as not free and remove it
-			//  from the free blocks list
-			second_block->block_data.is_free = 0;
-			remove_free_element(second_block);
-
-			// Return the corresponding pointer
-			spin_unlock_irqsave(heap_lock);
-			return (void*)second_block + sizeof(mem_desc);
-		}
+	// Objects in a slab are aligned to their size class, since slabs are aligned to SLAB_SIZE
+	//  and size classes are powers of two, so small allocations can be taken from the slabs
+	//  as long as the size class is a multiple of the alignment
+	int size_class = (size <= SLAB_MAX_OBJECT_SIZE) ? get_size_class(size) : NUM_SIZE_CLASSES;
+	if (size_class < NUM_SIZE_CLASSES && alignment != 0 &&
+		(SLAB_MIN_OBJECT_SIZE << size_class) % alignment == 0) {
+
+		ptr = slab_alloc(size_class);
+	} else {
+		ptr = block_alloc_aligned(size, alignment);
 	}
 
+	(ptr == NULL) ? (num_failed_allocations++) : (num_allocations++);
+
+#ifdef KHEAP_PROFILE_ENABLE
+	if (ptr != NULL)
+		ptr = tag_allocation(ptr, requested_size, tag_offset, __builtin_return_address(0));
+#endif
+
+	HEAP_TRACE(HEAP_TRACE_ALLOC, size, alignment, ptr);
+
 	spin_unlock_irqsave(heap_lock);
-	return NULL;
+	return ptr;
 }
 
 /*
@@ -246,30 +1004,114 @@ void* kmalloc_aligned(uint32_t size, uint32_t alignment) {
  * OUTPUTS: a pointer to a buffer of specified size
  */
 void* kmalloc(uint32_t size) {
+	void *ptr;
+
+#ifdef KHEAP_PROFILE_ENABLE
+	// Make room for the tag
+	uint32_t requested_size = size;
+	if (size <= HEAP_MAX_SIZE)
+		size += HEAP_PROFILE_TAG_SIZE;
+#endif
+
 	spin_lock_irqsave(heap_lock);
 
-	// Look for a free block in the linked list of free blocks
-	mem_desc *cur;
-	for (cur = free_head; cur != NULL; cur = cur->next_free) {
-		// Check if the block is exactly the right size
-		//  or if we can try splitting the current block into two pieces, 
-		//  where the first piece is of the desired size
-		if (cur->block_data.size == size + sizeof(mem_desc) ||
-			split_free_block(cur, size) != NULL) {
-
-			// Then, simply mark the block as not free and remove it from the free list
-			cur->block_data.is_free = 0;
-			remove_free_element(cur);
-
-			// Return the corresponding pointer
-			spin_unlock_irqsave(heap_lock);
-			return (void*)cur + sizeof(mem_desc);
+	// Small allocations are served in constant time by the slab layer
+	if (size <= SLAB_MAX_OBJECT_SIZE)
+		ptr = slab_alloc(get_size_class(size));
+	else
+		ptr = block_alloc(size);
+
+	(ptr == NULL) ? (num_failed_allocations++) : (num_allocations++);
+
+#ifdef KHEAP_PROFILE_ENABLE
+	if (ptr != NULL)
+		ptr = tag_allocation(ptr, requested_size, HEAP_PROFILE_TAG_SIZE, __builtin_return_address(0));
+#endif
+
+	HEAP_TRACE(HEAP_TRACE_ALLOC, size, 0, ptr);
+
+	spin_unlock_irqsave(heap_lock);
+	return ptr;
+}
+
+/*
+ * Resizes a buffer previously returned by kmalloc, keeping its contents up to the smaller of the
+ *  old and new sizes
+ * The buffer is resized in place if its slab size class does not change or if there is enough free
+ *  space right after it, and is otherwise moved to a new buffer
+ * Buffers from kmalloc_aligned must not be resized, since the alignment would not be kept
+ *
+ * INPUTS: ptr: a pointer previously returned by kmalloc or krealloc, or NULL to act like kmalloc
+ *         size: the new size of the buffer, or 0 to act like kfree
+ * OUTPUTS: a pointer to the resized buffer, or NULL if it could not be resized, in which case the
+ *          original buffer is left untouched
+ */
+void* krealloc(void *ptr, uint32_t size) {
+	if (ptr == NULL)
+		return kmalloc(size);
+
+	if (size == 0) {
+		kfree(ptr);
+		return NULL;
+	}
+
+	// The start of the underlying allocation, and where it ends up after being resized
+	void *buf = ptr;
+	void *new_buf = NULL;
+
+#ifdef KHEAP_PROFILE_ENABLE
+	// Make room for the tag, which is copied along with the contents and then rewritten
+	uint32_t requested_size = size;
+	if (size <= HEAP_MAX_SIZE)
+		size += HEAP_PROFILE_TAG_SIZE;
+	buf -= HEAP_PROFILE_TAG_SIZE;
+#endif
+
+	spin_lock_irqsave(heap_lock);
+
+	// Find out how much the buffer can currently hold, and try to resize it without moving it
+	uint32_t old_size;
+	slab_desc *slab = get_slab(buf);
+	if (slab->size_class != 0) {
+		old_size = SLAB_MIN_OBJECT_SIZE << (slab->size_class - 1);
+		if (size <= SLAB_MAX_OBJECT_SIZE && get_size_class(size) == slab->size_class - 1)
+			new_buf = buf;
+	} else {
+		old_size = ((mem_desc*)(buf - sizeof(mem_desc)))->block_data.size - sizeof(mem_desc);
+		if (block_resize(buf, size))
+			new_buf = buf;
+	}
+
+	// Otherwise, move the contents to a new buffer
+	if (new_buf == NULL) {
+		if (size <= SLAB_MAX_OBJECT_SIZE)
+			new_buf = slab_alloc(get_size_class(size));
+		else
+			new_buf = block_alloc(size);
+
+		if (new_buf != NULL) {
+			memcpy(new_buf, buf, (old_size < size) ? old_size : size);
+
+			(slab->size_class != 0) ? slab_free(slab, buf) : block_free(buf);
+			num_allocations++;
+			num_frees++;
+		} else {
+			num_failed_allocations++;
 		}
 	}
 
-	// If no free block was found, since we have a fixed size heap, return NULL
+#ifdef KHEAP_PROFILE_ENABLE
+	// Move the buffer over to the call site that resized it, using the copy of the tag
+	if (new_buf != NULL) {
+		untag_allocation(new_buf + HEAP_PROFILE_TAG_SIZE);
+		new_buf = tag_allocation(new_buf, requested_size, HEAP_PROFILE_TAG_SIZE, __builtin_return_address(0));
+	}
+#endif
+
+	HEAP_TRACE(HEAP_TRACE_REALLOC, size, (uint32_t)ptr, new_buf);
+
 	spin_unlock_irqsave(heap_lock);
-	return NULL;
+	return new_buf;
 }
 
 /*
@@ -285,55 +1127,356 @@ void kfree(void* ptr) {
 
 	spin_lock_irqsave(heap_lock);
 
-	// Get memory descriptor corresponding to this pointer and mark it free
-	mem_desc *cur = (mem_desc*)((void*)ptr - sizeof(mem_desc));
-	cur->block_data.is_free = 1;
-
-	// Push the block to the end of the free linked list
-	if (free_tail == NULL) {
-		free_head = cur;
-		free_tail = cur;
-		cur->next_free = NULL;
-		cur->prev_free = NULL;
-	} else {
-		cur->next_free = NULL;
-		cur->prev_free = free_tail;
-		free_tail->next_free = cur;
-		free_tail = cur;
+	HEAP_TRACE(HEAP_TRACE_FREE, 0, 0, ptr);
+
+#ifdef KHEAP_PROFILE_ENABLE
+	ptr = untag_allocation(ptr);
+#endif
+
+	// Pointers into a page that is being used as a slab belong to the slab layer
+	slab_desc *slab = get_slab(ptr);
+	if (slab->size_class != 0)
+		slab_free(slab, ptr);
+	else
+		block_free(ptr);
+
+	num_frees++;
+
+	spin_unlock_irqsave(heap_lock);
+}
+
+/*
+ * Fills in the provided struct with the current statistics of the kernel heap
+ *
+ * INPUTS: stats: the struct to fill in
+ */
+void get_heap_stats(heap_stats_t *stats) {
+	spin_lock_irqsave(heap_lock);
+
+	stats->heap_size = heap_end - (void*)head;
+	stats->bytes_in_use = bytes_in_use;
+	stats->free_bytes = stats->heap_size - bytes_in_use;
+	stats->peak_bytes_in_use = peak_bytes_in_use;
+	stats->num_allocations = num_allocations;
+	stats->num_frees = num_frees;
+	stats->num_failed_allocations = num_failed_allocations;
+
+	// The largest free block lies in the highest non-empty bin, so only that bin has to be searched
+	stats->largest_free_block = 0;
+	if (fl_bitmap != 0) {
+		int fl = find_last_set(fl_bitmap);
+		int sl = find_last_set(sl_bitmap[fl]);
+
+		mem_desc *cur;
+		for (cur = free_blocks[fl][sl]; cur != NULL; cur = cur->next_free) {
+			if (cur->block_data.size > stats->largest_free_block)
+				stats->largest_free_block = cur->block_data.size;
+		}
 	}
 
-	// Attempt to coalesce all contiguous free blocks
-	// Find the first free block going backwards
-	mem_desc *free_block, *first_free_block;
-	for (free_block = cur; free_block != NULL && free_block->block_data.is_free; free_block = free_block->prev) {
-		first_free_block = free_block;
+	// Memory is not fragmented at all if all the free memory is in one block
+	// Both sizes are scaled down together until the percentage can be computed without overflowing
+	uint32_t largest = stats->largest_free_block;
+	uint32_t free = stats->free_bytes;
+	while (largest > 0xFFFFFFFF / 100) {
+		largest >>= 1;
+		free >>= 1;
 	}
+	stats->fragmentation = (free == 0) ? 0 : 100 - largest * 100 / free;
 
-	// Starting from after the first free block, coalesce free blocks
-	for (free_block = first_free_block->next; free_block != NULL; free_block = free_block->next) {
-		// If the block isn't free, we can't coalesce any more
-		if (!free_block->block_data.is_free)
-			break;
+	spin_unlock_irqsave(heap_lock);
+}
+
+#ifndef KHEAP_HOSTED
+/*
+ * Appends a line of the form "name: value\n" to the provided string
+ *
+ * INPUTS: buf: a null terminated string with enough room for the line
+ *         name: the name of the value
+ *         value: the value to print in decimal
+ */
+static void append_stat(int8_t *buf, const int8_t *name, uint32_t value) {
+	buf += strlen(buf);
+
+	strcpy(buf, name);
+	buf += strlen(buf);
+	strcpy(buf, ": ");
+	buf += strlen(buf);
+	itoa(value, buf, 10);
+	buf += strlen(buf);
+	strcpy(buf, "\n");
+}
+
+/*
+ * Opens the heap statistics file, which always succeeds
+ */
+int32_t heap_stats_open(const uint8_t *filename) {
+	return 0;
+}
+
+/*
+ * Closes the heap statistics file, which always succeeds
+ */
+int32_t heap_stats_close(int32_t fd) {
+	return 0;
+}
+
+/*
+ * Reads the current heap statistics as text, one "name: value" pair per line
+ * Each read formats a fresh snapshot and continues from the current file position, so reading
+ *  until 0 bytes are returned gives the whole file; reopen the file to take another sample
+ * The read system call holds pcb_spin_lock while calling this function
+ *
+ * INPUTS: fd: the file descriptor of the heap statistics file
+ *         buf: the buffer to copy the text into
+ *         nbytes: the size of the buffer
+ * OUTPUTS: the number of bytes copied into the buffer
+ */
+int32_t heap_stats_read(int32_t fd, void *buf, int32_t nbytes) {
+	heap_stats_t stats;
+	get_heap_stats(&stats);
+
+	int8_t text[512];
+	text[0] = '\0';
+	append_stat(text, "heap_size", stats.heap_size);
+	append_stat(text, "bytes_in_use", stats.bytes_in_use);
+	append_stat(text, "free_bytes", stats.free_bytes);
+	append_stat(text, "largest_free_block", stats.largest_free_block);
+	append_stat(text, "fragmentation_percent", stats.fragmentation);
+	append_stat(text, "peak_bytes_in_use", stats.peak_bytes_in_use);
+	append_stat(text, "allocations", stats.num_allocations);
+	append_stat(text, "frees", stats.num_frees);
+	append_stat(text, "failed_allocations", stats.num_failed_allocations);
+
+	// Copy whatever is left after the current position in the file
+	file_t *file = &get_pcb()->files.data[fd];
+	uint32_t length = strlen(text);
+	int32_t i;
+	for (i = 0; i < nbytes && file->file_pos + i < length; i++)
+		*(int8_t*)(buf + i) = text[file->file_pos + i];
+
+	file->file_pos += i;
+	return i;
+}
+
+/*
+ * The heap statistics file is read-only, so writing always fails
+ */
+int32_t heap_stats_write(int32_t fd, const void *buf, int32_t nbytes) {
+	return -1;
+}
+
+/*
+ * Opens the heap trace file, which only succeeds if the kernel was built with KHEAP_TRACE_ENABLE
+ */
+int32_t heap_trace_open(const uint8_t *filename) {
+#ifdef KHEAP_TRACE_ENABLE
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+/*
+ * Closes the heap trace file, which always succeeds
+ */
+int32_t heap_trace_close(int32_t fd) {
+	return 0;
+}
+
+#ifdef KHEAP_TRACE_ENABLE
+/*
+ * Writes a value as exactly 8 hexadecimal digits, without a null terminator
+ *
+ * INPUTS: buf: a buffer with room for 8 characters
+ *         value: the value to write
+ */
+static void write_hex(int8_t *buf, uint32_t value) {
+	int i;
+	for (i = 7; i >= 0; i--) {
+		buf[i] = "0123456789abcdef"[value & 0xF];
+		value >>= 4;
+	}
+}
+#endif
+
+/*
+ * Reads the recorded trace as text, one call per line (the format is described in kheap.h)
+ * Every line has the same length, so the file position directly gives the record to continue from
+ * The read system call holds pcb_spin_lock while calling this function
+ *
+ * INPUTS: fd: the file descriptor of the heap trace file
+ *         buf: the buffer to copy the text into
+ *         nbytes: the size of the buffer
+ * OUTPUTS: the number of bytes copied into the buffer
+ */
+int32_t heap_trace_read(int32_t fd, void *buf, int32_t nbytes) {
+#ifdef KHEAP_TRACE_ENABLE
+	file_t *file = &get_pcb()->files.data[fd];
+	int8_t line[HEAP_TRACE_LINE_LENGTH];
+	int32_t i;
+
+	spin_lock_irqsave(heap_lock);
 
-		// Merge this block with first_free_block in the main blocks list
-		// Update next and next->prev if it exists
-		first_free_block->next = free_block->next;
-		if (free_block->next != NULL)
-			free_block->next->prev = first_free_block;
+	for (i = 0; i < nbytes; i++) {
+		uint32_t record = (file->file_pos + i) / HEAP_TRACE_LINE_LENGTH;
+		uint32_t offset = (file->file_pos + i) % HEAP_TRACE_LINE_LENGTH;
+		if (record >= num_trace_records)
+			break;
 
-		// Update the size of the block to have the combined size of both
-		first_free_block->block_data.size += free_block->block_data.size;
+		// Format the line whenever the copy reaches the start of a line (or starts midway through one)
+		if (offset == 0 || i == 0) {
+			heap_trace_record *cur = &trace_records[record];
+			line[0] = cur->op;
+			line[1] = ' ';
+			write_hex(&line[2], cur->size);
+			line[10] = ' ';
+			write_hex(&line[11], cur->alignment);
+			line[19] = ' ';
+			write_hex(&line[20], (uint32_t)cur->ptr);
+			line[28] = '\n';
+		}
 
-		// Merge this block with first_free_block in the free blocks list by simply removing it
-		(free_block->next_free == NULL) ? (free_tail = free_block->prev_free) : 
-		                                  (free_block->next_free->prev_free = free_block->prev_free);
-		(free_block->prev_free == NULL) ? (free_head = free_block->next_free) : 
-		                                  (free_block->prev_free->next_free = free_block->next_free);
+		*(int8_t*)(buf + i) = line[offset];
 	}
 
 	spin_unlock_irqsave(heap_lock);
+
+	file->file_pos += i;
+	return i;
+#else
+	return -1;
+#endif
+}
+
+/*
+ * The heap trace file is read-only, so writing always fails
+ */
+int32_t heap_trace_write(int32_t fd, const void *buf, int32_t nbytes) {
+	return -1;
+}
+
+/*
+ * Opens the heap profile file, which only succeeds if the kernel was built with KHEAP_PROFILE_ENABLE
+ */
+int32_t heap_profile_open(const uint8_t *filename) {
+#ifdef KHEAP_PROFILE_ENABLE
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+/*
+ * Closes the heap profile file, which always succeeds
+ */
+int32_t heap_profile_close(int32_t fd) {
+	return 0;
+}
+
+#ifdef KHEAP_PROFILE_ENABLE
+// The text of the report, which is generated when a read starts from the beginning of the file
+static int8_t profile_report[2 * HEAP_PROFILE_REPORT_SITES * HEAP_PROFILE_ENTRY_LENGTH + 256];
+
+/*
+ * Returns the average number of allocations per second made from a call site since its first one
+ */
+static uint32_t get_allocation_rate(heap_profile_site *site, uint32_t now) {
+	uint32_t seconds = (now - site->first_allocation) / 1000;
+	return (seconds == 0) ? site->num_allocations : site->num_allocations / seconds;
+}
+
+/*
+ * Appends the table of the call sites with the highest values of the given key to the report
+ * heap_lock must be held when calling this function
+ *
+ * INPUTS: title: the line to put above the table
+ *         by_rate: whether to sort by allocation rate rather than live bytes
+ *         now: the current time in milliseconds
+ */
+static void append_profile_table(const int8_t *title, int by_rate, uint32_t now) {
+	// Insertion sort the indices of the sites, highest key first
+	uint32_t order[HEAP_PROFILE_MAX_SITES];
+	uint32_t keys[HEAP_PROFILE_MAX_SITES];
+	uint32_t i, j;
+	for (i = 0; i < num_profile_sites; i++) {
+		uint32_t key = by_rate ? get_allocation_rate(&profile_sites[i], now) : profile_sites[i].live_bytes;
+		for (j = i; j > 0 && keys[j - 1] < key; j--) {
+			keys[j] = keys[j - 1];
+			order[j] = order[j - 1];
+		}
+		keys[j] = key;
+		order[j] = i;
+	}
+
+	strcpy(profile_report + strlen(profile_report), title);
+
+	for (i = 0; i < num_profile_sites && i < HEAP_PROFILE_REPORT_SITES; i++) {
+		heap_profile_site *site = &profile_sites[order[i]];
+		int8_t *buf = profile_report + strlen(profile_report);
+
+		strcpy(buf, "0x");
+		itoa((uint32_t)site->call_site, buf + 2, 16);
+		strcpy(buf + strlen(buf), "\n");
+		append_stat(buf, "    live_bytes", site->live_bytes);
+		append_stat(buf, "    live_blocks", site->live_blocks);
+		append_stat(buf, "    allocations_per_sec", get_allocation_rate(site, now));
+		append_stat(buf, "    average_lifetime_ms",
+		            (site->num_frees == 0) ? 0 : site->total_lifetime / site->num_frees);
+	}
+}
+#endif
+
+/*
+ * Reads a report of the allocations made from each call site as text, listing the call sites with
+ *  the most live bytes (likely leaks) and the highest allocation rates
+ * Call sites are return addresses, which can be found in the kernel's disassembly
+ * The report is generated when the read starts at the beginning of the file, so reopen the file
+ *  to take another sample
+ * The read system call holds pcb_spin_lock while calling this function
+ *
+ * INPUTS: fd: the file descriptor of the heap profile file
+ *         buf: the buffer to copy the text into
+ *         nbytes: the size of the buffer
+ * OUTPUTS: the number of bytes copied into the buffer
+ */
+int32_t heap_profile_read(int32_t fd, void *buf, int32_t nbytes) {
+#ifdef KHEAP_PROFILE_ENABLE
+	file_t *file = &get_pcb()->files.data[fd];
+
+	if (file->file_pos == 0) {
+		uint32_t now = get_profile_time();
+
+		spin_lock_irqsave(heap_lock);
+
+		profile_report[0] = '\0';
+		append_profile_table("CALL SITES BY LIVE BYTES\n", 0, now);
+		append_profile_table("\nCALL SITES BY ALLOCATION RATE\n", 1, now);
+
+		spin_unlock_irqsave(heap_lock);
+	}
+
+	// Copy whatever is left after the current position in the file
+	uint32_t length = strlen(profile_report);
+	int32_t i;
+	for (i = 0; i < nbytes && file->file_pos + i < length; i++)
+		*(int8_t*)(buf + i) = profile_report[file->file_pos + i];
+
+	file->file_pos += i;
+	return i;
+#else
+	return -1;
+#endif
 }
 
+/*
+ * The heap profile file is read-only, so writing always fails
+ */
+int32_t heap_profile_write(int32_t fd, const void *buf, int32_t nbytes) {
+	return -1;
+}
+#endif /* KHEAP_HOSTED */
+
 /*
  * Lists all of the blocks allocated in the kernel heap
  * Primarily intended for debugging memory leaks
@@ -341,7 +1484,7 @@ void kfree(void* ptr) {
 void list_allocated_blocks() {
 	printf("LISTING ALL ALLOCATED BLOCKS\n");
 	mem_desc *cur;
-	for (cur = head; cur != NULL; cur = cur->next) {
+	for (cur = head; cur != NULL; cur = next_block(cur)) {
 		if (!cur->block_data.is_free) {
 			printf("   ADDR: 0x%x   SIZE: 0x%x\n", cur, cur->block_data.size);
 		}
@@ -354,9 +1497,14 @@ void list_allocated_blocks() {
  */
 void list_free_blocks() {
 	printf("LISTING ALL FREE BLOCKS\n");
+	int fl, sl;
 	mem_desc *cur;
-	for (cur = free_head; cur != NULL; cur = cur->next_free) {
-		printf("   ADDR: 0x%x   SIZE: 0x%x\n", cur, cur->block_data.size);
+	for (fl = 0; fl < FL_INDEX_COUNT; fl++) {
+		for (sl = 0; sl < SL_INDEX_COUNT; sl++) {
+			for (cur = free_blocks[fl][sl]; cur != NULL; cur = cur->next_free) {
+				printf("   ADDR: 0x%x   SIZE: 0x%x\n", cur, cur->block_data.size);
+			}
+		}
 	}
 }
 
@@ -365,13 +1513,16 @@ void list_free_blocks() {
  */
 void verify_no_overlaps() {
 	void *cur_addr = (void*)KERNEL_HEAP_START_ADDR;
-	mem_desc *cur;
-	for (cur = head; cur != NULL; cur = cur->next) {
-		if (cur_addr != (void*)cur) {
+	mem_desc *cur, *prev;
+	for (prev = NULL, cur = head; cur != NULL; prev = cur, cur = next_block(cur)) {
+		if (cur_addr != (void*)cur || cur->prev != prev) {
 			printf("OVERLAP FOUND!\n");
 			return;
 		}
 
 		cur_addr += cur->block_data.size;
 	}
+
+	if (cur_addr != heap_end)
+		printf("OVERLAP FOUND!\n");
 }
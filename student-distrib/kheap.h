@@ -2,14 +2,26 @@
 #define _KHEAP_H
 
 #include "types.h"
-#include "paging.h"
 
-// Clears the entire heap and fills it with zeroes
+// Uncomment KHEAP_TRACE_ENABLE to record every call to kmalloc, kmalloc_aligned, krealloc and kfree
+//  so that the trace can be read from HEAP_TRACE_FILENAME and replayed by the hosted benchmark (heapbench/)
+// #define KHEAP_TRACE_ENABLE
+
+// Uncomment KHEAP_PROFILE_ENABLE to tag every buffer with the call site and time of its allocation
+//  and keep statistics for each call site, which can be read from HEAP_PROFILE_FILENAME
+// Every buffer grows by at least 16 bytes while profiling
+// #define KHEAP_PROFILE_ENABLE
+
+// Sets up the heap as a single free block, which is filled with zeroes lazily as it is first used
 void init_kheap();
 // Allocates a buffer of the specified size in the kernel heap and returns a pointer to it
 void* kmalloc(uint32_t size);
 // Allocates a buffer of the specified size that is aligned to a multiple of the parameter alignment
+//  (which must be a power of two)
 void* kmalloc_aligned(uint32_t size, uint32_t alignment);
+// Resizes a buffer previously returned by kmalloc, in place if possible, keeping its contents
+// Returns NULL and leaves the buffer untouched if it could not be resized
+void* krealloc(void *ptr, uint32_t size);
 // Frees the memory associated with a pointer previously returned by kmalloc
 // Double frees are not allowed in this implementation! 
 void kfree(void* ptr);
@@ -20,6 +32,67 @@ void list_free_blocks();
 // Verifies that none of the blocks in the linked list overlap (primarily for debugging)
 void verify_no_overlaps();
 
+// A snapshot of the health of the kernel heap
+// Sizes are measured in whole blocks (including descriptors and slab pages), not requested bytes
+typedef struct heap_stats_t {
+	// The current size of the heap, which grows and shrinks in 4MB pages
+	uint32_t heap_size;
+	// The number of bytes in blocks that are allocated
+	uint32_t bytes_in_use;
+	// The number of bytes in blocks that are free
+	uint32_t free_bytes;
+	// The size of the largest free block, which bounds the largest allocation that can succeed
+	uint32_t largest_free_block;
+	// The percentage of free memory that is not part of the largest free block
+	uint32_t fragmentation;
+	// The highest value that bytes_in_use has reached
+	uint32_t peak_bytes_in_use;
+	// The number of successful calls to kmalloc / kmalloc_aligned
+	uint32_t num_allocations;
+	// The number of calls to kfree with a non-NULL pointer
+	uint32_t num_frees;
+	// The number of calls to kmalloc / kmalloc_aligned that returned NULL
+	uint32_t num_failed_allocations;
+} heap_stats_t;
+
+// Fills in the provided struct with the current statistics of the kernel heap
+void get_heap_stats(heap_stats_t *stats);
+
+// The name of the special file that userspace programs can open to read the heap statistics as text
+#define HEAP_STATS_FILENAME "kheap"
+
+// File operations for the heap statistics file
+int32_t heap_stats_open(const uint8_t *filename);
+int32_t heap_stats_close(int32_t fd);
+int32_t heap_stats_read(int32_t fd, void *buf, int32_t nbytes);
+int32_t heap_stats_write(int32_t fd, const void *buf, int32_t nbytes);
+
+// The name of the special file that userspace programs can open to read the trace recorded with
+//  KHEAP_TRACE_ENABLE; opening it fails if the kernel was built without tracing
+// Each call is one line of the form "A SSSSSSSS AAAAAAAA PPPPPPPP" where A is the operation below,
+//  and S, A and P are the size, alignment (0 for kmalloc) and pointer in hexadecimal
+// For krealloc, the alignment is replaced by the pointer that was passed in
+#define HEAP_TRACE_FILENAME "kheaptrace"
+#define HEAP_TRACE_ALLOC 'A'
+#define HEAP_TRACE_FREE 'F'
+#define HEAP_TRACE_REALLOC 'R'
+
+// File operations for the heap trace file
+int32_t heap_trace_open(const uint8_t *filename);
+int32_t heap_trace_close(int32_t fd);
+int32_t heap_trace_read(int32_t fd, void *buf, int32_t nbytes);
+int32_t heap_trace_write(int32_t fd, const void *buf, int32_t nbytes);
+
+// The name of the special file that userspace programs can open to read the report of the call
+//  sites of allocations kept with KHEAP_PROFILE_ENABLE; opening it fails if profiling is disabled
+#define HEAP_PROFILE_FILENAME "kheapprof"
+
+// File operations for the heap profile file
+int32_t heap_profile_open(const uint8_t *filename);
+int32_t heap_profile_close(int32_t fd);
+int32_t heap_profile_read(int32_t fd, void *buf, int32_t nbytes);
+int32_t heap_profile_write(int32_t fd, const void *buf, int32_t nbytes);
+
 // Lock that can be acquired to prevent any allocations on the heap
 extern struct spinlock_t heap_lock;
 
@@ -7,6 +7,7 @@
 #include "graphics/graphics.h"
 #include "mouse.h"
 #include "window_manager/window_manager.h"
+#include "work_queue.h"
 
 #define MOUSE_PORT   			0x60
 #define MOUSE_STATUS 			0x64
@@ -142,6 +143,24 @@ void set_mouse_rate(int8_t rate) {
 	// sti();                 
 }
 
+/*
+ * Lets the window manager know where the mouse is and redraws the screen, which is run by the worker
+ *  thread after the mouse interrupt rather than in it, since drawing the screen takes a while
+ * Movements that arrive before this runs are handled together, since it uses the latest position
+ */
+static void update_mouse(void *unused) {
+	mouse_event(mouse.x, mouse.y);
+
+	// printf("Mouse.ata: x: %d   y: %d   scroll: %d   left: %d   right: %d\n", mouse.x, mouse.y, mouse.scroll, mouse.left_click, mouse.right_click);
+	if (active_tty == 4)
+		draw_pixel(svga.frame_buffer, svga.width, mouse.x, mouse.y, 0xFFFFFFFF);
+	// svga_update(0, 0, svga.width, svga.height);
+	mouse.old_x = mouse.x;
+	mouse.old_y = mouse.y;
+}
+
+static work_t mouse_work = WORK_INIT(update_mouse, NULL);
+
 int mouse_cycle = -5;              
 int32_t x = SYSTEM_RESOLUTION_WIDTH / 2;
 int32_t y = SYSTEM_RESOLUTION_HEIGHT / 2;
@@ -200,14 +219,7 @@ void mouse_handler() {
 		// mouse_event(mouse.x, mouse.y);
 	}
 
-	mouse_event(mouse.x, mouse.y);
-
-	// printf("Mouse.ata: x: %d   y: %d   scroll: %d   left: %d   right: %d\n", mouse.x, mouse.y, mouse.scroll, mouse.left_click, mouse.right_click);
-	if (active_tty == 4)
-		draw_pixel(svga.frame_buffer, svga.width, mouse.x, mouse.y, 0xFFFFFFFF);
-	// svga_update(0, 0, svga.width, svga.height);
-	mouse.old_x = mouse.x;
-	mouse.old_y = mouse.y;
+	queue_work(&mouse_work);
 }
 
 void bound_mouse_coordinates() {
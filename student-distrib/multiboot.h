@@ -56,6 +56,9 @@ typedef struct module {
     uint32_t reserved;
 } module_t;
 
+/* The type of a memory map entry for memory that is free to use. */
+#define MULTIBOOT_MEMORY_AVAILABLE      1
+
 /* The memory map. Be careful that the offset 0 is base_addr_low
    but no size. */
 typedef struct memory_map {
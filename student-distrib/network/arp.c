@@ -17,14 +17,14 @@ uint32_t num_open_arp_entries = ARP_TABLE_SIZE;
 /*
  * Flushes all ARP entries that have been in the table for more than ARP_TIMEOUT seconds
  *
- * INPUTS: time: the current system time
+ * INPUTS: time: the current system time, in timer ticks
  * SIDE EFFECTS: removes some entries from arp_table
  */
-void flush_arp_entries(double time) {
+void flush_arp_entries(uint32_t time) {
 	int i;
 	for (i = 0; i < ARP_TABLE_SIZE; i++) {
 		// Remove the entry if enough time has passed
-		if (arp_table[i].state != ARP_TABLE_ENTRY_EMPTY && time - arp_table[i].time_added > ARP_TIMEOUT) {
+		if (arp_table[i].state != ARP_TABLE_ENTRY_EMPTY && time - arp_table[i].time_added > ARP_TIMEOUT * PIT_FREQUENCY) {
 			ARP_DEBUG("ARP entry for IP %d.%d.%d.%d expired\n",
 				arp_table[i].ip_addr[0], arp_table[i].ip_addr[1], arp_table[i].ip_addr[2], arp_table[i].ip_addr[3]);
 
@@ -48,7 +48,7 @@ void init_arp() {
 	// Set the callback to occur every ARP_TIMEOUT seconds
 	// Notice that this means that entries might ACTUALLY be flushed anywhere from
 	//  ARP_TIMEOUT seconds to 2*ARP_TIMEOUT seconds, though this is not a big deal
-	timer_callback_id = register_periodic_callback((int)(PIT_FREQUENCY * ARP_TIMEOUT), flush_arp_entries);
+	timer_callback_id = register_periodic_callback(PIT_FREQUENCY * ARP_TIMEOUT, flush_arp_entries);
 }
 
 /*
@@ -300,14 +300,14 @@ int receive_arp_packet(uint8_t *buffer, uint32_t length, int32_t vlan, uint32_t
 	// Also keep track of the oldest item in the table in case the table is full and we need
 	//  to select an entry to replace
 	int inserted_entry = 0;
-	double oldest_time = 2 * sys_time;
+	uint32_t oldest_age = 0;
 	int oldest_index = -1;
 	int i, j;
 	for (i = 0; i < ARP_TABLE_SIZE; i++) {
 		// Keep track of the oldest item in the table
-		if (arp_table[i].state != ARP_TABLE_ENTRY_EMPTY && arp_table[i].time_added < oldest_time) {
+		if (arp_table[i].state != ARP_TABLE_ENTRY_EMPTY && (oldest_index == -1 || sys_time - arp_table[i].time_added > oldest_age)) {
 			oldest_index = i;
-			oldest_time = arp_table[i].time_added;
+			oldest_age = sys_time - arp_table[i].time_added;
 		}
 
 		// Check if the current entry is an old entry or waiting for the same IP address on the same Ethernet device
@@ -15,7 +15,7 @@
 // The number of entries in the ARP table
 #define ARP_TABLE_SIZE 64
 // The amount of time an entry in the ARP table stays valid in seconds
-#define ARP_TIMEOUT 10.0
+#define ARP_TIMEOUT 10
 
 // The size of an ARP packet in bytes
 #define ARP_PACKET_SIZE 28
@@ -62,8 +62,8 @@ typedef struct arp_packet arp_packet;
 typedef struct arp_table_entry {
 	// Whether or not the entry is present
 	uint8_t state;
-	// The time at which the entry was added
-	double time_added;
+	// The time at which the entry was added, in timer ticks (see sys_time)
+	uint32_t time_added;
 	// The IP and MAC addresses that are paired together
 	uint8_t ip_addr[IPV4_ADDR_SIZE];
 	uint8_t mac_addr[MAC_ADDR_SIZE];
@@ -242,18 +242,20 @@ typedef struct received_udp_packet {
 	char buffer[3000];
 } received_udp_packet;
 
+// The processes waiting in udp_read for a packet to arrive
+static wait_queue_t udp_read_queue = WAIT_QUEUE_EMPTY;
+
 int32_t udp_read(int32_t fd, void *buf, int32_t bytes) {
 	spin_lock_irqsave(pcb_spin_lock);
 
 	pcb_t *pcb = get_pcb();
-	int32_t pid = pcb->pid;
 
 	// Set aside a buffer and store it in the PCB
 	pcb->blocking_call.type = BLOCKING_CALL_UDP_READ;
 	pcb->blocking_call.data = (uint32_t)kmalloc(sizeof(received_udp_packet));
 
 	// Put the process to sleep while we wait for a response
-	process_sleep(pid);
+	process_wait(&udp_read_queue);
 
 	spin_lock_irqsave(pcb_spin_lock);
 
@@ -319,21 +321,16 @@ int receive_udp_packet(uint8_t *buffer, uint8_t src_mac_addr[MAC_ADDR_SIZE], uin
 			// Forward the packet to DHCP processing code
 			return receive_dhcp_packet(buffer + IP_HEADER_SIZE + UDP_HEADER_SIZE, src_mac_addr, udp_data_length, id);
 		default:
-			// Go through all the PCBs looking for something that is waiting on a UDP read
-			for (i = 0; i < pcbs.length; i++) {
-				if (pcbs.data[i].pid >= 0 && pcbs.data[i].state == PROCESS_SLEEPING &&
-					pcbs.data[i].blocking_call.type == BLOCKING_CALL_UDP_READ) {
-
-					// Copy the data into the buffer and wake up the process
-					received_udp_packet *packet = (received_udp_packet*)pcbs.data[i].blocking_call.data;
-					packet->length = udp_data_length;
-
-					uint8_t *syscall_buffer = (uint8_t*)packet->buffer;
-					int j;
-					for (j = 0; j < udp_data_length; j++) {
-						syscall_buffer[j] = buffer[IP_HEADER_SIZE + UDP_HEADER_SIZE + j];
-					}
-					process_wake(i);
+			// Wake up every process that is waiting on a UDP read and copy the data into its buffer,
+			//  which is done before any of them run again since interrupts are disabled
+			while ((i = wake_up(&udp_read_queue)) != -1) {
+				received_udp_packet *packet = (received_udp_packet*)pcbs.data[i].blocking_call.data;
+				packet->length = udp_data_length;
+
+				uint8_t *syscall_buffer = (uint8_t*)packet->buffer;
+				int j;
+				for (j = 0; j < udp_data_length; j++) {
+					syscall_buffer[j] = buffer[IP_HEADER_SIZE + UDP_HEADER_SIZE + j];
 				}
 			}
 
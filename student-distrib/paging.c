@@ -1,12 +1,27 @@
 #include "paging.h"
+#include "kheap.h"
+#include "spinlock.h"
+#include "dynamic_array.h"
 
-static unsigned int page_directory[PAGE_DIRECTORY_SIZE];
+// The page directory containing only the kernel's mappings, which every process' page directory starts as a copy of
+uint32_t kernel_page_directory[PAGE_DIRECTORY_SIZE] __attribute__((aligned (PAGE_ALIGNMENT)));
 static unsigned int video_page_table[PAGE_TABLE_SIZE] __attribute__((aligned (PAGE_ALIGNMENT)));
 
+// The page directory that is currently loaded into CR3
+static uint32_t *cur_page_directory = kernel_page_directory;
+
+// All the page directories created by create_page_directory, which must be kept up to date
+//  whenever the kernel's mappings change (initialized with the first one, since paging is set up before the heap)
+typedef DYNAMIC_ARRAY(uint32_t*, page_directory_dyn_arr) page_directory_dyn_arr;
+static page_directory_dyn_arr page_directories;
+
 // A struct which represents a large 4MB page in physical memory, and keeps track of other pages near it
 typedef struct large_page {
 	// Whether or not the page is in use
 	uint8_t used;
+	// Whether or not the page lies entirely within memory that the multiboot memory map lists as usable
+	// Pages that are not usable stay marked as used, so they are never handed out
+	uint8_t usable;
 	// If this page is not in use, the index of another page that is not in use,
 	//  which should form a linked list of unused pages. The last item in the list points to -1
 	// If this page IS in use, this value is a don't care
@@ -15,11 +30,45 @@ typedef struct large_page {
 
 // An array of large_page structures, in order of position in physical memory
 // So, the first item corresponds to the page from 0MB-4MB, the second corresponds to 4MB-8MB, etc
-large_page large_pages[LAST_ACCESSIBLE_ADDR / LARGE_PAGE_SIZE];
+large_page large_pages[MAX_LARGE_PAGES];
+
+// The number of large pages up to the end of the last usable one
+static int32_t num_large_pages = 0;
 
 // The index of the head of the linked list of unused pages
 int32_t unused_page_head_index;
 
+// 4KB frames are handed out by a buddy allocator, which splits large pages taken from the list above
+//  into blocks of 2^order frames and gives each large page back once all of its frames are free again
+// Each free block stores the links of its free list in its first frame, through the kernel's mapping
+//  of physical memory at PHYS_MAP_ADDR
+typedef struct free_frame_block {
+	// The first frames of the next and previous free blocks of the same order, or -1 if there are none
+	int32_t next;
+	int32_t prev;
+} free_frame_block;
+
+// The number of frames in the large pages up to the end of the last usable one
+static int32_t num_physical_frames = 0;
+// For each frame, 1 + the order of the free block that starts at it, or 0 if no free block starts there
+// This and frame_refcounts depend on how much memory there is, so they are kept in the first large
+//  page handed out rather than in the kernel image (see init_frame_metadata)
+static uint8_t *free_frame_orders;
+// The first frame of the first free block of each order, or -1 if there are none
+// Blocks of order MAX_FRAME_ORDER are whole large pages, which go back to the list of unused large pages
+static int32_t free_frame_heads[MAX_FRAME_ORDER];
+// The number of pages that reference each used frame, which is more than 1 for frames shared after fork
+// (the counts of unused frames are meaningless, and are set when the frames are allocated)
+static uint16_t *frame_refcounts;
+
+// Frames that have already been zeroed, so that pages that start out empty can be handed out without
+//  clearing them while a process waits (see refill_zeroed_frames)
+// These frames are used, with a reference count of 1 held by the pool
+static int32_t zeroed_frames[ZEROED_FRAME_POOL_SIZE];
+static uint32_t num_zeroed_frames = 0;
+
+static struct spinlock_t frame_lock = SPIN_LOCK_UNLOCKED;
+
 /*
  * Writes a page directory address to the cr3 register
  *
@@ -36,12 +85,28 @@ do {                                  \
 } while (0)
 
 /*
- * Enables paging by setting bit 31 in CR0
+ * Invalidates the TLB entry for the page containing the given virtual address, which is the only
+ *  way to remove global pages from the TLB, since they are kept when CR3 is written
+ *
+ * INPUT: addr: a virtual address within the page to invalidate
+ */
+#define invlpg(addr)                  \
+do {                                  \
+	asm volatile ("invlpg (%k0)"      \
+		:                             \
+		: "r"((addr))                 \
+		: "memory"                    \
+	);                                \
+} while (0)
+
+/*
+ * Enables paging by setting bit 31 in CR0, as well as bit 16 (WP) so that the kernel faults when
+ *  writing to read-only pages of processes, just like the processes themselves (which copy-on-write relies on)
  */
 static inline void enable_paging() {
 	asm volatile ("           \n\
 		mov %%cr0, %%eax      \n\
-		or $0x80000000, %%eax \n\
+		or $0x80010000, %%eax \n\
 		mov %%eax, %%cr0"
 		:
 		:
@@ -64,19 +129,153 @@ static inline void enable_page_size_extension() {
 }
 
 /*
- * Unconditionally maps a region of specified size starting from the
- *  given virtual address to the region of the same size starting from the given physical address
+ * Enables global pages by setting bit 7 (PGE) of CR4, so that the kernel's mappings stay in
+ *  the TLB when switching between the page directories of processes
+ */
+static inline void enable_global_pages() {
+	asm volatile ("       \n\
+		mov %%cr4, %%eax  \n\
+		or $0x80, %%eax   \n\
+		mov %%eax, %%cr4"
+		:
+		:
+		: "eax", "cc"
+	);
+}
+
+/*
+ * Flushes every entry from the TLB, including global ones, by turning global pages off and on again
+ */
+static inline void flush_tlb_global() {
+	asm volatile ("          \n\
+		mov %%cr4, %%eax     \n\
+		and $~0x80, %%eax    \n\
+		mov %%eax, %%cr4     \n\
+		or $0x80, %%eax      \n\
+		mov %%eax, %%cr4"
+		:
+		:
+		: "eax", "cc", "memory"
+	);
+}
+
+/*
+ * Starts a batch of changes to a page directory, whose TLB flushes are deferred until it is committed
  *
- * INPUTS: start_phys_addr: the start of the region in physical memory
+ * INPUTS: transaction: the transaction to initialize
+ *         page_directory: the page directory to change, or NULL for the kernel's mappings,
+ *                         which are marked global and shared by every page directory
+ */
+void begin_page_transaction(page_transaction *transaction, uint32_t *page_directory) {
+	memset(transaction, 0, sizeof(page_transaction));
+	transaction->page_directory = page_directory;
+}
+
+/*
+ * Records that the translation of a page may be in the TLB and must be flushed when the transaction is committed
+ *
+ * INPUTS: transaction: the transaction that changed the page
+ *         virt_addr: the virtual address of the page
+ *         old_entry: the page directory or page table entry that the page had before
+ */
+static void add_stale_page(page_transaction *transaction, uint32_t virt_addr, uint32_t old_entry) {
+	if (transaction->num_stale < PAGE_TRANSACTION_MAX_INVLPG)
+		transaction->stale_addrs[transaction->num_stale] = virt_addr;
+	transaction->num_stale++;
+
+	if (old_entry & PAGE_GLOBAL)
+		transaction->stale_global = 1;
+}
+
+/*
+ * Sets a single page directory entry as part of a transaction and records the change
+ *
+ * INPUTS: transaction: the transaction that the change is part of
+ *         pde_index: the index of the entry to change
+ *         pde: the new value of the entry
+ */
+static void set_pde(page_transaction *transaction, uint32_t pde_index, uint32_t pde) {
+	uint32_t *page_directory = (transaction->page_directory == NULL) ? kernel_page_directory
+	                                                                 : transaction->page_directory;
+	uint32_t old_pde = page_directory[pde_index];
+	page_directory[pde_index] = pde;
+
+	transaction->changed[pde_index / 32] |= 1 << (pde_index % 32);
+
+	// Entries that were not present cannot be in the TLB, so only present entries need to be flushed
+	if (!(old_pde & PAGE_PRESENT))
+		return;
+
+	if (old_pde & PAGE_SIZE_IS_4M) {
+		add_stale_page(transaction, pde_index * LARGE_PAGE_SIZE, old_pde);
+	} else {
+		// Any of the pages in a page table that was replaced may be in the TLB, so flush everything
+		transaction->num_stale = PAGE_TRANSACTION_MAX_INVLPG + 1;
+	}
+}
+
+/*
+ * Sets a single page table entry as part of a transaction and records the change, creating the
+ *  page table if there is none yet
+ *
+ * INPUTS: transaction: the transaction that the change is part of, which must not be for the kernel's mappings
+ *         virt_addr: the virtual address of the 4KB page to change
+ *         pte: the new value of the entry
+ * OUTPUTS: 0 on success and -1 if a page table could not be allocated, or if the 4MB region containing
+ *          the page is mapped as a single page or belongs to the kernel
+ */
+static int32_t set_pte(page_transaction *transaction, uint32_t virt_addr, uint32_t pte) {
+	uint32_t pde_index = virt_addr / LARGE_PAGE_SIZE;
+	uint32_t pde = transaction->page_directory[pde_index];
+	uint32_t *page_table;
+
+	if (!(pde & PAGE_PRESENT)) {
+		// There is nothing to unmap if there is no page table
+		if (!(pte & PAGE_PRESENT))
+			return 0;
+
+		// Page tables are taken from the kernel heap, which is identity mapped, so their virtual and
+		//  physical addresses are the same
+		page_table = kmalloc_aligned(PAGE_TABLE_SIZE * sizeof(uint32_t), PAGE_ALIGNMENT);
+		if (page_table == NULL)
+			return -1;
+		memset(page_table, 0, PAGE_TABLE_SIZE * sizeof(uint32_t));
+
+		// The page directory entry allows all accesses, and each page table entry restricts them
+		set_pde(transaction, pde_index, (uint32_t)page_table | PAGE_USER_LEVEL | PAGE_READ_WRITE | PAGE_PRESENT);
+	} else if ((pde & PAGE_SIZE_IS_4M) || pde == kernel_page_directory[pde_index]) {
+		return -1;
+	} else {
+		page_table = (uint32_t*)(pde & PAGE_ADDR_MASK);
+	}
+
+	uint32_t pte_index = (virt_addr / NORMAL_PAGE_SIZE) % PAGE_TABLE_SIZE;
+	uint32_t old_pte = page_table[pte_index];
+	page_table[pte_index] = pte;
+
+	if (old_pte & PAGE_PRESENT)
+		add_stale_page(transaction, virt_addr, old_pte);
+
+	return 0;
+}
+
+/*
+ * Maps a region of specified size starting from the given virtual address to the region of the
+ *  same size starting from the given physical address as part of a transaction
+ *
+ * INPUTS: transaction: the transaction that the change is part of
+ *         start_phys_addr: the start of the region in physical memory
  *         start_virt_addr: the start of the region in virtual memory
  *         num_pdes: the size of the region in multiples of 4MB
- *         flags: the flags that should be applied to the PDE (4MB page and present will be included by default)
+ *         flags: the flags that should be applied to the PDE (4MB page and present will be included by default,
+ *                as well as global for the kernel's mappings)
  * OUTPUTS: 0 on success
  */
-int32_t map_region(void *start_phys_addr, void *start_virt_addr, uint32_t num_pdes, uint32_t flags) {
-	// Align the two inputs to the nearest 4MB boundary (if they are not already)
-	start_phys_addr = (void*)(((uint32_t)start_phys_addr / LARGE_PAGE_SIZE) * LARGE_PAGE_SIZE);
-	start_virt_addr = (void*)(((uint32_t)start_virt_addr / LARGE_PAGE_SIZE) * LARGE_PAGE_SIZE);
+int32_t page_transaction_map(page_transaction *transaction, void *start_phys_addr, void *start_virt_addr,
+                             uint32_t num_pdes, uint32_t flags) {
+	// Kernel mappings are the same in every process, so they never need to be flushed on a switch
+	if (transaction->page_directory == NULL)
+		flags |= PAGE_GLOBAL;
 
 	// Mark all the desired pages as 4M, present pages, as well as the custom flags
 	unsigned int i, cur_pde_index;
@@ -88,41 +287,283 @@ int32_t map_region(void *start_phys_addr, void *start_virt_addr, uint32_t num_pd
 		if (cur_pde_index >= PAGE_DIRECTORY_SIZE || cur_phys_index >= PAGE_DIRECTORY_SIZE) 
 			break;
 
-		page_directory[cur_pde_index] = (cur_phys_index * PAGE_TABLE_SIZE * PAGE_ALIGNMENT) |
-			flags | PAGE_SIZE_IS_4M | PAGE_PRESENT;
+		set_pde(transaction, cur_pde_index, (cur_phys_index * PAGE_TABLE_SIZE * PAGE_ALIGNMENT) |
+			flags | PAGE_SIZE_IS_4M | PAGE_PRESENT);
 	}
 
-	// Reload the page directory
-	write_cr3(&page_directory);
-
 	return 0;
 }
 
 /*
- * Unconditionally unmaps the 4MB aligned region containing the specified region
- *  from the page directory
+ * Unmaps the 4MB aligned region containing the specified region as part of a transaction
  *
- * INPUTS: start_addr: the start virtual address of the region to unmap
+ * INPUTS: transaction: the transaction that the change is part of
+ *         start_addr: the start virtual address of the region to unmap
  *         num_pdes: the size of the region in 4MB increments
- * SIDE EFFECTS: modifies the page directory
  */
-void unmap_region(void *start_addr, uint32_t num_pdes) {
-	// The start address rounded down to the nearest 4MB (1 << 22 bytes)
-	void *start_addr_aligned = (void*)((unsigned int)start_addr / LARGE_PAGE_SIZE * LARGE_PAGE_SIZE);
-
+void page_transaction_unmap(page_transaction *transaction, void *start_addr, uint32_t num_pdes) {
 	// Mark all the desired pages as not present
 	unsigned int i, cur_pde_index;
 	for (i = 0; i < num_pdes; i++) {
-		cur_pde_index = (unsigned int)(start_addr_aligned) / LARGE_PAGE_SIZE + i;
+		cur_pde_index = (unsigned int)(start_addr) / LARGE_PAGE_SIZE + i;
 
 		if (cur_pde_index >= PAGE_DIRECTORY_SIZE)
 			break;
 
-		page_directory[cur_pde_index] = 0;
+		set_pde(transaction, cur_pde_index, 0);
+	}
+}
+
+/*
+ * Maps consecutive 4KB frames to consecutive 4KB pages starting at the given virtual address as part
+ *  of a transaction, creating page tables as needed
+ * The kernel's mappings are only made of 4MB pages, so this cannot be used for them
+ *
+ * INPUTS: transaction: the transaction that the change is part of
+ *         frame: the index of the first frame (the physical address divided by 4KB)
+ *         start_virt_addr: the virtual address of the first page, which must be 4KB aligned
+ *         num_frames: the number of frames to map
+ *         flags: the flags that should be applied to each PTE (present is included by default)
+ * OUTPUTS: 0 on success and -1 if a page table could not be allocated or the region cannot hold
+ *          4KB pages, in which case some of the frames may have been mapped
+ */
+int32_t page_transaction_map_frames(page_transaction *transaction, int32_t frame, void *start_virt_addr,
+                                    uint32_t num_frames, uint32_t flags) {
+	if (transaction->page_directory == NULL)
+		return -1;
+
+	uint32_t i;
+	for (i = 0; i < num_frames; i++) {
+		if (set_pte(transaction, (uint32_t)start_virt_addr + i * NORMAL_PAGE_SIZE,
+				(frame + i) * NORMAL_PAGE_SIZE | flags | PAGE_PRESENT) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Unmaps consecutive 4KB pages starting at the given virtual address as part of a transaction
+ * The page tables are kept until the page directory is freed
+ *
+ * INPUTS: transaction: the transaction that the change is part of
+ *         start_virt_addr: the virtual address of the first page, which must be 4KB aligned
+ *         num_frames: the number of pages to unmap
+ */
+void page_transaction_unmap_frames(page_transaction *transaction, void *start_virt_addr, uint32_t num_frames) {
+	if (transaction->page_directory == NULL)
+		return;
+
+	uint32_t i;
+	for (i = 0; i < num_frames; i++)
+		set_pte(transaction, (uint32_t)start_virt_addr + i * NORMAL_PAGE_SIZE, 0);
+}
+
+/*
+ * Gets the page table entry of a 4KB page in the given page directory
+ *
+ * INPUTS: page_directory: the page directory to look in
+ *         virt_addr: any address in the page
+ * OUTPUTS: the page table entry, or 0 if the page is not mapped with a page table
+ */
+uint32_t get_page_table_entry(uint32_t *page_directory, void *virt_addr) {
+	uint32_t pde = page_directory[(uint32_t)virt_addr / LARGE_PAGE_SIZE];
+	if (!(pde & PAGE_PRESENT) || (pde & PAGE_SIZE_IS_4M))
+		return 0;
+
+	return ((uint32_t*)(pde & PAGE_ADDR_MASK))[((uint32_t)virt_addr / NORMAL_PAGE_SIZE) % PAGE_TABLE_SIZE];
+}
+
+/*
+ * Gets the frame that a 4KB page is mapped to in the given page directory
+ *
+ * INPUTS: page_directory: the page directory to look in
+ *         virt_addr: any address in the page
+ * OUTPUTS: the index of the frame, or -1 if the page is not present or is not mapped with a page table
+ */
+int32_t get_mapped_frame(uint32_t *page_directory, void *virt_addr) {
+	uint32_t pte = get_page_table_entry(page_directory, virt_addr);
+	if (!(pte & PAGE_PRESENT))
+		return -1;
+
+	return pte / NORMAL_PAGE_SIZE;
+}
+
+/*
+ * Finishes a transaction by copying changes to the kernel's mappings into the page directory of
+ *  every process and flushing the changed entries from the TLB with as little work as possible
+ * Up to PAGE_TRANSACTION_MAX_INVLPG entries are flushed one at a time with invlpg; beyond that,
+ *  the whole TLB is flushed at once
+ *
+ * INPUTS: transaction: the transaction to commit
+ */
+void commit_page_transaction(page_transaction *transaction) {
+	int is_kernel = (transaction->page_directory == NULL);
+	uint32_t i, j;
+
+	// Keep the kernel's part of every page directory identical
+	if (is_kernel) {
+		for (i = 0; i < PAGE_DIRECTORY_SIZE; i++) {
+			if (!(transaction->changed[i / 32] & (1 << (i % 32))))
+				continue;
+
+			for (j = 0; j < page_directories.length; j++)
+				page_directories.data[j][i] = kernel_page_directory[i];
+		}
+	}
+
+	// Changes to a page directory that is not in use will be picked up when CR3 is next loaded
+	if (transaction->num_stale == 0 || (!is_kernel && transaction->page_directory != cur_page_directory))
+		return;
+
+	if (transaction->num_stale <= PAGE_TRANSACTION_MAX_INVLPG) {
+		for (i = 0; i < transaction->num_stale; i++)
+			invlpg(transaction->stale_addrs[i]);
+	} else if (transaction->stale_global) {
+		flush_tlb_global();
+	} else {
+		write_cr3(cur_page_directory);
 	}
+}
+
+/*
+ * Unconditionally maps a region of specified size starting from the given virtual address to the
+ *  region of the same size starting from the given physical address, in the given page directory only
+ * This is used for the memory of a single process; the TLB is only flushed if the page directory
+ *  is the one currently in use
+ *
+ * INPUTS: page_directory: the page directory to add the mapping to, or NULL for the kernel's mappings
+ *         start_phys_addr: the start of the region in physical memory
+ *         start_virt_addr: the start of the region in virtual memory
+ *         num_pdes: the size of the region in multiples of 4MB
+ *         flags: the flags that should be applied to the PDE (4MB page and present will be included by default)
+ * OUTPUTS: 0 on success
+ */
+int32_t map_region_into(uint32_t *page_directory, void *start_phys_addr, void *start_virt_addr,
+                        uint32_t num_pdes, uint32_t flags) {
+	page_transaction transaction;
+	begin_page_transaction(&transaction, page_directory);
+	page_transaction_map(&transaction, start_phys_addr, start_virt_addr, num_pdes, flags);
+	commit_page_transaction(&transaction);
+	return 0;
+}
 
-	// Reload the page directory
-	write_cr3(&page_directory);
+/*
+ * Unconditionally unmaps the 4MB aligned region containing the specified region from the given
+ *  page directory only
+ *
+ * INPUTS: page_directory: the page directory to remove the mapping from, or NULL for the kernel's mappings
+ *         start_addr: the start virtual address of the region to unmap
+ *         num_pdes: the size of the region in 4MB increments
+ * SIDE EFFECTS: modifies the page directory
+ */
+void unmap_region_from(uint32_t *page_directory, void *start_addr, uint32_t num_pdes) {
+	page_transaction transaction;
+	begin_page_transaction(&transaction, page_directory);
+	page_transaction_unmap(&transaction, start_addr, num_pdes);
+	commit_page_transaction(&transaction);
+}
+
+/*
+ * Unconditionally maps a region of specified size starting from the given virtual address to the
+ *  region of the same size starting from the given physical address into the kernel's memory,
+ *  which is shared by every page directory
+ * Kernel mappings are always marked global, since they are the same in every process
+ *
+ * INPUTS: start_phys_addr: the start of the region in physical memory
+ *         start_virt_addr: the start of the region in virtual memory
+ *         num_pdes: the size of the region in multiples of 4MB
+ *         flags: the flags that should be applied to the PDE (4MB page, global and present will be included by default)
+ * OUTPUTS: 0 on success
+ */
+int32_t map_region(void *start_phys_addr, void *start_virt_addr, uint32_t num_pdes, uint32_t flags) {
+	return map_region_into(NULL, start_phys_addr, start_virt_addr, num_pdes, flags);
+}
+
+/*
+ * Unconditionally unmaps the 4MB aligned region containing the specified region from the kernel's
+ *  memory, which is shared by every page directory
+ *
+ * INPUTS: start_addr: the start virtual address of the region to unmap
+ *         num_pdes: the size of the region in 4MB increments
+ * SIDE EFFECTS: modifies every page directory
+ */
+void unmap_region(void *start_addr, uint32_t num_pdes) {
+	unmap_region_from(NULL, start_addr, num_pdes);
+}
+
+/*
+ * Creates a page directory for a process, which starts out with only the kernel's mappings
+ *
+ * OUTPUTS: the new page directory, or NULL if it could not be allocated
+ */
+uint32_t* create_page_directory() {
+	uint32_t *page_directory = kmalloc_aligned(PAGE_DIRECTORY_SIZE * sizeof(uint32_t), PAGE_ALIGNMENT);
+	if (page_directory == NULL)
+		return NULL;
+
+	// Keep track of the page directory so that later changes to the kernel's mappings reach it
+	if (page_directories.data == NULL)
+		DYN_ARR_INIT(uint32_t*, page_directories);
+	if (page_directories.data == NULL || DYN_ARR_PUSH(uint32_t*, page_directories, page_directory) < 0) {
+		kfree(page_directory);
+		return NULL;
+	}
+
+	memcpy(page_directory, kernel_page_directory, PAGE_DIRECTORY_SIZE * sizeof(uint32_t));
+	return page_directory;
+}
+
+/*
+ * Frees a page directory returned by create_page_directory, switching to the kernel's page
+ *  directory first if it is the one in use
+ *
+ * INPUTS: page_directory: the page directory to free
+ */
+void free_page_directory(uint32_t *page_directory) {
+	if (page_directory == NULL)
+		return;
+
+	if (page_directory == cur_page_directory)
+		load_page_directory(kernel_page_directory);
+
+	// Free the page tables that belong to this page directory, which are the ones not shared with the kernel
+	uint32_t index;
+	for (index = 0; index < PAGE_DIRECTORY_SIZE; index++) {
+		uint32_t pde = page_directory[index];
+		if ((pde & PAGE_PRESENT) && !(pde & PAGE_SIZE_IS_4M) && pde != kernel_page_directory[index])
+			kfree((void*)(pde & PAGE_ADDR_MASK));
+	}
+
+	for (index = 0; index < page_directories.length; index++) {
+		if (page_directories.data[index] == page_directory) {
+			DYN_ARR_REMOVE(uint32_t*, page_directories, index);
+			break;
+		}
+	}
+
+	kfree(page_directory);
+}
+
+/*
+ * Switches to the given page directory by writing it to CR3, which flushes every mapping
+ *  from the TLB except for the kernel's global mappings
+ *
+ * INPUTS: page_directory: the page directory to switch to
+ */
+void load_page_directory(uint32_t *page_directory) {
+	if (page_directory == cur_page_directory)
+		return;
+
+	cur_page_directory = page_directory;
+	write_cr3(page_directory);
+}
+
+/*
+ * Returns the page directory that is currently in use
+ */
+uint32_t* get_page_directory() {
+	return cur_page_directory;
 }
 
 /*
@@ -200,6 +641,29 @@ int32_t get_open_page() {
 	return page;
 }
 
+/*
+ * Marks the unused page at the provided index as used, for callers that need a particular page
+ *  rather than any page (such as the kernel heap, which grows into the pages right after it)
+ *
+ * INPUTS: index: the index of the large page to claim, in increments of 4MB
+ * OUTPUTS: 0 on success and -1 if the page does not exist or is already used
+ */
+int32_t claim_page(int32_t index) {
+	if (index < 0 || index >= num_large_pages || large_pages[index].used)
+		return -1;
+
+	// Find the page in the unused page linked list and remove it
+	int32_t *cur;
+	for (cur = &unused_page_head_index; *cur != index; cur = &large_pages[*cur].next_free) {
+		if (*cur < 0)
+			return -1;
+	}
+	*cur = large_pages[index].next_free;
+
+	large_pages[index].used = 1;
+	return 0;
+}
+
 /*
  * Marks the page at the provided index as unused
  *
@@ -207,7 +671,7 @@ int32_t get_open_page() {
  */
 void free_page(int32_t index) {
 	// Validate that the index is valid
-	if (index < 0 || index >= LAST_ACCESSIBLE_ADDR / LARGE_PAGE_SIZE)
+	if (index < 0 || index >= num_large_pages)
 		return;
 
 	large_pages[index].used = 0;
@@ -217,6 +681,298 @@ void free_page(int32_t index) {
 	unused_page_head_index = index;
 }
 
+// Gets the free list links stored in the first frame of a free block
+#define FREE_FRAME_BLOCK(frame) ((free_frame_block*)phys_to_virt((frame) * NORMAL_PAGE_SIZE))
+
+/*
+ * Adds a block of frames to the front of the free list of its order
+ * frame_lock should be locked before calling this function
+ */
+static void add_free_frames(int32_t frame, uint32_t order) {
+	free_frame_block *block = FREE_FRAME_BLOCK(frame);
+	block->prev = -1;
+	block->next = free_frame_heads[order];
+	if (block->next != -1)
+		FREE_FRAME_BLOCK(block->next)->prev = frame;
+
+	free_frame_heads[order] = frame;
+	free_frame_orders[frame] = order + 1;
+}
+
+/*
+ * Removes a block of frames from the free list of its order
+ * frame_lock should be locked before calling this function
+ */
+static void remove_free_frames(int32_t frame, uint32_t order) {
+	free_frame_block *block = FREE_FRAME_BLOCK(frame);
+	if (block->prev == -1)
+		free_frame_heads[order] = block->next;
+	else
+		FREE_FRAME_BLOCK(block->prev)->next = block->next;
+	if (block->next != -1)
+		FREE_FRAME_BLOCK(block->next)->prev = block->prev;
+
+	free_frame_orders[frame] = 0;
+}
+
+/*
+ * Returns an unused block of 2^order 4KB frames, aligned to its size, and marks it used
+ * The smallest free block that is large enough is split in halves until it is the right size, and if
+ *  there is none, an unused 4MB page is split instead
+ *
+ * INPUTS: order: the log base 2 of the number of frames, up to MAX_FRAME_ORDER for a whole 4MB page
+ * OUTPUTS: the index of the first frame of the block (its physical address divided by 4KB),
+ *          or -1 if there is not enough memory
+ */
+int32_t alloc_frames(uint32_t order) {
+	if (order > MAX_FRAME_ORDER)
+		return -1;
+
+	spin_lock_irqsave(frame_lock);
+
+	// Find the smallest order with a free block
+	uint32_t cur_order;
+	for (cur_order = order; cur_order < MAX_FRAME_ORDER && free_frame_heads[cur_order] == -1; cur_order++);
+
+	int32_t frame;
+	if (cur_order == MAX_FRAME_ORDER) {
+		int32_t page = get_open_page();
+		if (page == -1) {
+			// As a last resort, single frames are taken back from the pool of zeroed frames
+			frame = (order == 0 && num_zeroed_frames > 0) ? zeroed_frames[--num_zeroed_frames] : -1;
+			spin_unlock_irqsave(frame_lock);
+			return frame;
+		}
+		frame = page * FRAMES_PER_LARGE_PAGE;
+	} else {
+		frame = free_frame_heads[cur_order];
+		remove_free_frames(frame, cur_order);
+	}
+
+	// Split the block, giving back the upper half each time
+	while (cur_order > order) {
+		cur_order--;
+		add_free_frames(frame + (1 << cur_order), cur_order);
+	}
+
+	// Each frame starts out referenced only by whoever allocated it
+	int32_t i;
+	for (i = 0; i < (1 << order); i++)
+		frame_refcounts[frame + i] = 1;
+
+	spin_unlock_irqsave(frame_lock);
+	return frame;
+}
+
+/*
+ * Marks a block of frames as unused, merging it with its buddy (the other half of the block of the next
+ *  order) for as long as the buddy is free as well, and giving back whole 4MB pages once they are free
+ *
+ * INPUTS: frame: the index of the first frame of the block, which must be aligned to its size
+ *         order: the log base 2 of the number of frames in the block
+ */
+void free_frames(int32_t frame, uint32_t order) {
+	if (frame < 0 || frame >= num_physical_frames || order > MAX_FRAME_ORDER)
+		return;
+
+	spin_lock_irqsave(frame_lock);
+
+	while (order < MAX_FRAME_ORDER) {
+		int32_t buddy = frame ^ (1 << order);
+		if (free_frame_orders[buddy] != order + 1)
+			break;
+
+		remove_free_frames(buddy, order);
+		frame &= ~(1 << order);
+		order++;
+	}
+
+	if (order == MAX_FRAME_ORDER)
+		free_page(frame / FRAMES_PER_LARGE_PAGE);
+	else
+		add_free_frames(frame, order);
+
+	spin_unlock_irqsave(frame_lock);
+}
+
+/*
+ * Returns consecutive unused 4KB frames and marks them used, by allocating the smallest block that
+ *  holds them and giving back the frames at the end of it that are not needed
+ *
+ * INPUTS: num_frames: the number of frames, which can be at most FRAMES_PER_LARGE_PAGE
+ * OUTPUTS: the index of the first frame, or -1 if there is not enough memory
+ */
+int32_t alloc_contiguous_frames(uint32_t num_frames) {
+	if (num_frames == 0 || num_frames > FRAMES_PER_LARGE_PAGE)
+		return -1;
+
+	uint32_t order;
+	for (order = 0; (1u << order) < num_frames; order++);
+
+	int32_t frame = alloc_frames(order);
+	if (frame != -1 && num_frames < (1u << order))
+		free_contiguous_frames(frame + num_frames, (1 << order) - num_frames);
+
+	return frame;
+}
+
+/*
+ * Marks consecutive frames as unused by splitting them into the largest aligned blocks possible
+ *
+ * INPUTS: frame: the index of the first frame
+ *         num_frames: the number of frames
+ */
+void free_contiguous_frames(int32_t frame, uint32_t num_frames) {
+	while (num_frames > 0) {
+		uint32_t order;
+		for (order = 0; order < MAX_FRAME_ORDER && !(frame & (1 << order)) && (2u << order) <= num_frames; order++);
+
+		free_frames(frame, order);
+		frame += 1 << order;
+		num_frames -= 1 << order;
+	}
+}
+
+/*
+ * Adds a reference to a used frame, for when it is about to be shared by another page (such as
+ *  when fork shares the pages of a process with its child)
+ *
+ * INPUTS: frame: the index of the frame
+ */
+void share_frame(int32_t frame) {
+	if (frame < 0 || frame >= num_physical_frames)
+		return;
+
+	spin_lock_irqsave(frame_lock);
+	frame_refcounts[frame]++;
+	spin_unlock_irqsave(frame_lock);
+}
+
+/*
+ * Removes a reference to a used frame, and marks it as unused once no page references it anymore
+ *
+ * INPUTS: frame: the index of the frame
+ */
+void release_frame(int32_t frame) {
+	if (frame < 0 || frame >= num_physical_frames)
+		return;
+
+	spin_lock_irqsave(frame_lock);
+	uint32_t refcount = --frame_refcounts[frame];
+	spin_unlock_irqsave(frame_lock);
+
+	if (refcount == 0)
+		free_frames(frame, 0);
+}
+
+/*
+ * Gets the number of pages that reference a used frame
+ *
+ * INPUTS: frame: the index of the frame
+ * OUTPUTS: the reference count, which is 1 if the frame is not shared
+ */
+uint32_t get_frame_refcount(int32_t frame) {
+	if (frame < 0 || frame >= num_physical_frames)
+		return 0;
+
+	return frame_refcounts[frame];
+}
+
+/*
+ * Returns an unused 4KB frame that is filled with zeros and marks it used, taking it from the pool of
+ *  frames that were zeroed ahead of time if possible and zeroing it now otherwise
+ *
+ * OUTPUTS: the index of the frame, or -1 if there is not enough memory
+ */
+int32_t alloc_zeroed_frame() {
+	spin_lock_irqsave(frame_lock);
+	int32_t frame = (num_zeroed_frames > 0) ? zeroed_frames[--num_zeroed_frames] : -1;
+	spin_unlock_irqsave(frame_lock);
+	if (frame != -1)
+		return frame;
+
+	frame = alloc_frames(0);
+	if (frame != -1)
+		memset(phys_to_virt(frame * NORMAL_PAGE_SIZE), 0, NORMAL_PAGE_SIZE);
+	return frame;
+}
+
+/*
+ * Zeroes one more frame for alloc_zeroed_frame to hand out, if the pool of zeroed frames is not full
+ * This is meant to be called over and over while there is nothing else to do, so it only does a
+ *  single frame's worth of work at a time, with interrupts enabled while the frame is cleared
+ *
+ * OUTPUTS: 1 if a frame was added to the pool, and 0 if the pool is full or there is no memory
+ */
+int32_t refill_zeroed_frames() {
+	spin_lock_irqsave(frame_lock);
+	uint32_t full = (num_zeroed_frames == ZEROED_FRAME_POOL_SIZE);
+	spin_unlock_irqsave(frame_lock);
+	if (full)
+		return 0;
+
+	int32_t frame = alloc_frames(0);
+	if (frame == -1)
+		return 0;
+	memset(phys_to_virt(frame * NORMAL_PAGE_SIZE), 0, NORMAL_PAGE_SIZE);
+
+	// The pool may have been filled in the meantime
+	spin_lock_irqsave(frame_lock);
+	if (num_zeroed_frames < ZEROED_FRAME_POOL_SIZE) {
+		zeroed_frames[num_zeroed_frames++] = frame;
+		frame = -1;
+	}
+	spin_unlock_irqsave(frame_lock);
+
+	if (frame != -1) {
+		free_frames(frame, 0);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Records a range of physical memory that the multiboot memory map lists as usable, so that the 4MB
+ *  pages that lie entirely within it can be handed out once paging is initialized
+ * Parts of the range that do not fill a whole 4MB page, and anything past MAX_PHYS_ADDR, are ignored
+ *
+ * INPUTS: start_addr: the physical address of the start of the range
+ *         size: the size of the range in bytes
+ */
+void add_physical_memory(uint32_t start_addr, uint32_t size) {
+	if (start_addr >= MAX_PHYS_ADDR)
+		return;
+
+	uint32_t end_addr = (size > MAX_PHYS_ADDR - start_addr) ? MAX_PHYS_ADDR : start_addr + size;
+	int32_t first_page = (start_addr + LARGE_PAGE_SIZE - 1) / LARGE_PAGE_SIZE;
+	int32_t end_page = end_addr / LARGE_PAGE_SIZE;
+
+	int32_t i;
+	for (i = first_page; i < end_page; i++)
+		large_pages[i].usable = 1;
+	if (end_page > num_large_pages)
+		num_large_pages = end_page;
+}
+
+/*
+ * Sets aside memory for the state of every frame, taking it from the first large page handed out
+ * This must be called with paging enabled, since the memory is reached through the mapping of
+ *  physical memory at PHYS_MAP_ADDR
+ * The state takes 3 bytes per frame, so a single 4MB page is enough for up to MAX_PHYS_ADDR
+ */
+static void init_frame_metadata() {
+	int32_t page = get_open_page();
+	if (page == -1)
+		return;
+
+	num_physical_frames = num_large_pages * FRAMES_PER_LARGE_PAGE;
+	frame_refcounts = phys_to_virt(page * LARGE_PAGE_SIZE);
+	free_frame_orders = (uint8_t*)(frame_refcounts + num_physical_frames);
+
+	// No free blocks have been split out of any page yet
+	memset(free_frame_orders, 0, num_physical_frames);
+}
+
 /*
  * Initializes the page directory
  * Sets CR0 and CR4 to correctly support paging
@@ -236,22 +992,23 @@ void init_paging() {
 			// The page is not present
 			video_page_table[i] = ~PAGE_PRESENT;
 		} else {
-			// The page is present
-			video_page_table[i] = (i * NORMAL_PAGE_SIZE) | PAGE_READ_WRITE | PAGE_PRESENT;
+			// The page is present (and global, since the table is shared by every page directory)
+			video_page_table[i] = (i * NORMAL_PAGE_SIZE) | PAGE_GLOBAL | PAGE_READ_WRITE | PAGE_PRESENT;
 		}
 	}
 
-	// Set page_directory[0] to point to the video page table and mark large page #0 as used
-	page_directory[0] = (unsigned long)(&video_page_table) | PAGE_DISABLE_CACHE | PAGE_READ_WRITE | PAGE_PRESENT;
+	// Set kernel_page_directory[0] to point to the video page table and mark large page #0 as used
+	kernel_page_directory[0] = (unsigned long)(&video_page_table) | PAGE_DISABLE_CACHE | PAGE_READ_WRITE | PAGE_PRESENT;
 	large_pages[0].used = 1;
 
 	// Map kernel memory starting at 4MB to a 4MB page and mark large page #1 as used
-	page_directory[1] = KERNEL_START_ADDR | PAGE_GLOBAL | PAGE_SIZE_IS_4M | PAGE_READ_WRITE | PAGE_PRESENT;
+	kernel_page_directory[1] = KERNEL_START_ADDR | PAGE_GLOBAL | PAGE_SIZE_IS_4M | PAGE_READ_WRITE | PAGE_PRESENT;
 	large_pages[1].used = 1;
 
 	// Map in kernel heap memory
-	identity_map_containing_region((void*)KERNEL_HEAP_START_ADDR, HEAP_SIZE,
-		KERNEL_HEAP_START_ADDR | PAGE_GLOBAL | PAGE_SIZE_IS_4M | PAGE_READ_WRITE | PAGE_PRESENT);
+	// (only the flags are passed, since map_region fills in the address of each page itself)
+	map_region((void*)KERNEL_HEAP_START_ADDR, (void*)KERNEL_HEAP_START_ADDR, HEAP_SIZE / LARGE_PAGE_SIZE,
+		PAGE_GLOBAL | PAGE_READ_WRITE);
 	// Mark the kernel heap memory as used
 	for (i = KERNEL_HEAP_START_ADDR / LARGE_PAGE_SIZE; i < KERNEL_HEAP_END_ADDR / LARGE_PAGE_SIZE; i++)
 		large_pages[i].used = 1;
@@ -259,29 +1016,54 @@ void init_paging() {
 	// Set all other page directory entries to not present
 	for (i = KERNEL_HEAP_END_ADDR / LARGE_PAGE_SIZE; i < PAGE_DIRECTORY_SIZE; i++) {
 		// Set bit 0 to zero, which means that the page is not present
-		page_directory[i] &= ~PAGE_PRESENT;
+		kernel_page_directory[i] &= ~PAGE_PRESENT;
+	}
 
-		// Mark the page as unused as well, if it exists in physical memory
-		if (i < LAST_ACCESSIBLE_ADDR / LARGE_PAGE_SIZE) {
-			large_pages[i].used = 0;
+	// The kernel and its heap are always there, even if the memory map was missing or left them out
+	if (num_large_pages < KERNEL_HEAP_END_ADDR / LARGE_PAGE_SIZE)
+		num_large_pages = KERNEL_HEAP_END_ADDR / LARGE_PAGE_SIZE;
 
-			// Connect all the unused pages with linked list connections
-			if (i == LAST_ACCESSIBLE_ADDR / LARGE_PAGE_SIZE - 1)
-				large_pages[i].next_free = -1;
-			else
-				large_pages[i].next_free = i + 1;
+	// Map all of physical memory that can be used for the kernel, so that frames can be reached
+	//  without mapping them (holes in the memory map are left unmapped, since they may be devices)
+	for (i = 0; i < num_large_pages; i++) {
+		if (i < KERNEL_HEAP_END_ADDR / LARGE_PAGE_SIZE || large_pages[i].usable) {
+			kernel_page_directory[PHYS_MAP_ADDR / LARGE_PAGE_SIZE + i] = (i * LARGE_PAGE_SIZE) |
+				PAGE_GLOBAL | PAGE_SIZE_IS_4M | PAGE_READ_WRITE | PAGE_PRESENT;
 		}
 	}
 
-	// Mark the head of the linked list of unused page to the end of the heap
-	unused_page_head_index = KERNEL_HEAP_END_ADDR / LARGE_PAGE_SIZE;
+	// No frames have been split out of 4MB pages yet
+	for (i = 0; i < MAX_FRAME_ORDER; i++)
+		free_frame_heads[i] = -1;
+
+	// Hand out the pages after the space the heap can grow into first, and the pages that the heap
+	//  can grow into only once those have run out, so that the heap is usually able to grow
+	// Pages go on the front of the list when they are freed, so they are freed in the reverse order
+	// Every page starts out used, so that only the usable ones are ever handed out
+	for (i = KERNEL_HEAP_END_ADDR / LARGE_PAGE_SIZE; i < num_large_pages; i++)
+		large_pages[i].used = 1;
+	unused_page_head_index = -1;
+	for (i = KERNEL_HEAP_MAX_ADDR / LARGE_PAGE_SIZE - 1; i >= KERNEL_HEAP_END_ADDR / LARGE_PAGE_SIZE; i--) {
+		if (i < num_large_pages && large_pages[i].usable)
+			free_page(i);
+	}
+	for (i = num_large_pages - 1; i >= KERNEL_HEAP_MAX_ADDR / LARGE_PAGE_SIZE; i--) {
+		if (large_pages[i].usable)
+			free_page(i);
+	}
 
 	// Write the page directory to the page directory register
-	write_cr3(&page_directory);
+	write_cr3(kernel_page_directory);
 
 	// Enable 4MB pages
 	enable_page_size_extension();
 
 	// Enable paging
 	enable_paging();
+
+	// Enable global pages, which must be done after paging is enabled
+	enable_global_pages();
+
+	// The frames can only be tracked once their state can be reached through the mapping of physical memory
+	init_frame_metadata();
 }
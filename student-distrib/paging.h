@@ -4,10 +4,13 @@
 #include "lib.h"
 #include "types.h"
 
-// The last address we will deem as accessible in the system 
-// This is hardcoded to 224MB, which is a conservative estimate, since accessing the real value
-//  is a fairly non trivial task that involves messing around with the BIOS
-#define LAST_ACCESSIBLE_ADDR 0xE000000
+// The memory that is actually installed is read from the multiboot memory map (see add_physical_memory)
+// Memory past this address (3GB) is ignored, so that the kernel's mapping of physical memory at
+//  PHYS_MAP_ADDR stays below the memory of PCI devices, which is identity mapped near the top of
+//  the address space
+#define MAX_PHYS_ADDR 0xC0000000
+// The largest number of 4MB pages of physical memory that can be used
+#define MAX_LARGE_PAGES (MAX_PHYS_ADDR / LARGE_PAGE_SIZE)
 
 // The size of a large 4MB page (4MB)
 #define LARGE_PAGE_SIZE 0x400000
@@ -36,10 +39,28 @@
 #define KERNEL_HEAP_END_ADDR     0x1400000
 // The size of the kernel heap (12MB)
 #define HEAP_SIZE (KERNEL_HEAP_END_ADDR - KERNEL_HEAP_START_ADDR)
+// The heap can grow by claiming the 4MB pages right after it, up to 64MB in physical memory
+//  (it is identity mapped, since drivers give heap buffers to devices for DMA)
+#define KERNEL_HEAP_MAX_ADDR     0x4000000
+// The largest size that the kernel heap can grow to (56MB)
+#define HEAP_MAX_SIZE (KERNEL_HEAP_MAX_ADDR - KERNEL_HEAP_START_ADDR)
 // The kernel ends with the kernel heap at 20MB
 #define KERNEL_END_ADDR KERNEL_HEAP_END_ADDR
 // The virtual address that video memory is mapped to for userspace programs (192MB)
 #define VIDEO_USER_VIRT_ADDR (192 * 1024 * 1024)
+// The virtual address that all usable physical memory is mapped to for the kernel (256MB), so that
+//  the kernel can reach any frame without mapping it first
+#define PHYS_MAP_ADDR 0x10000000
+
+// Gets the address in the kernel's mapping of physical memory that the given physical address is at
+#define phys_to_virt(addr) ((void*)(PHYS_MAP_ADDR + (uint32_t)(addr)))
+
+// The number of 4KB frames in a 4MB page
+#define FRAMES_PER_LARGE_PAGE (LARGE_PAGE_SIZE / NORMAL_PAGE_SIZE)
+// Blocks of frames are allocated in sizes of 2^order frames, and blocks of order 10 are whole 4MB pages
+#define MAX_FRAME_ORDER 10
+// The number of frames that are zeroed ahead of time, while the kernel has nothing else to do
+#define ZEROED_FRAME_POOL_SIZE 64
 
 /////////////////////////////////////////////////
 // Page table / page directory entry constants //
@@ -58,18 +79,53 @@
 #define PAGE_READ_WRITE          0x2
 // Enabled if the page is present
 #define PAGE_PRESENT             0x1
-
+// Enabled (in a bit that the processor leaves to the OS) if the page is shared read-only after fork,
+//  and should be copied the first time it is written to
+#define PAGE_COPY_ON_WRITE       0x200
+// The bits of an entry that hold the address of the page or page table
+#define PAGE_ADDR_MASK           0xFFFFF000
+
+// The number of stale pages that committing a page transaction flushes one at a time with invlpg;
+//  if more pages than this are stale, or a page table was replaced, the whole TLB is flushed instead
+#define PAGE_TRANSACTION_MAX_INVLPG 8
+
+// A batch of changes to a page directory, which are made right away but only flushed from the TLB
+//  (and copied to every page directory, for the kernel's mappings) when the batch is committed
+typedef struct page_transaction {
+	// The page directory being changed, or NULL for the kernel's mappings
+	uint32_t *page_directory;
+	// A bitmap of the page directory entries that were changed
+	uint32_t changed[PAGE_DIRECTORY_SIZE / 32];
+	// The virtual addresses of the pages that were present before being changed (only those can be
+	//  in the TLB), of which only the first PAGE_TRANSACTION_MAX_INVLPG are kept
+	uint32_t stale_addrs[PAGE_TRANSACTION_MAX_INVLPG];
+	// The number of stale pages, which is more than PAGE_TRANSACTION_MAX_INVLPG if everything must be flushed
+	uint32_t num_stale;
+	// Whether any of the stale entries were global, which loading CR3 does not flush
+	uint8_t stale_global;
+} page_transaction;
+
+// Records a range of physical memory that the multiboot memory map lists as usable, which must be
+//  done for all of them before paging is initialized
+void add_physical_memory(uint32_t start_addr, uint32_t size);
 // Initializes paging by setting Page Directory Base Register to page directory
 //  that maps the 4M kernel page as well as video memory
 void init_paging();
 
-// If there is no mapping already existing, maps a region of specified size starting from the
-//  given virtual address to the region of the same size starting from the given physical address
+// Maps a region of specified size starting from the given virtual address to the region of the same
+//  size starting from the given physical address into the kernel's memory, which every page directory shares
 int32_t map_region(void *start_phys_addr, void *start_virt_addr, uint32_t num_pdes, uint32_t flags);
 
-// Unconditionally unmaps the 4MB aligned region containing the specified region
+// Unconditionally unmaps the 4MB aligned region containing the specified region from the kernel's memory
 void unmap_region(void* start_addr, uint32_t num_pdes);
 
+// Maps a region into the given page directory only, such as the page directory of a single process
+int32_t map_region_into(uint32_t *page_directory, void *start_phys_addr, void *start_virt_addr,
+                        uint32_t num_pdes, uint32_t flags);
+
+// Unconditionally unmaps the 4MB aligned region containing the specified region from the given page directory only
+void unmap_region_from(uint32_t *page_directory, void *start_addr, uint32_t num_pdes);
+
 // If there is no mapping already existing, maps in a 4MB-aligned region made up of large 4MB pages
 //  that fully contains the desired region
 int32_t map_containing_region(void *start_phys_addr, void *start_virt_addr, uint32_t size, uint32_t flags);
@@ -87,9 +143,61 @@ int32_t map_video_mem_user(void *phys_addr);
 // Unmaps the video memory paged in for userspace programs 
 void unmap_video_mem_user();
 
+// Starts a batch of changes to the given page directory, or to the kernel's mappings if it is NULL
+void begin_page_transaction(page_transaction *transaction, uint32_t *page_directory);
+// Maps a region made up of 4MB pages as part of a transaction
+int32_t page_transaction_map(page_transaction *transaction, void *start_phys_addr, void *start_virt_addr,
+                             uint32_t num_pdes, uint32_t flags);
+// Unmaps a region made up of 4MB pages as part of a transaction
+void page_transaction_unmap(page_transaction *transaction, void *start_addr, uint32_t num_pdes);
+// Maps consecutive 4KB frames into a process' page directory as part of a transaction
+int32_t page_transaction_map_frames(page_transaction *transaction, int32_t frame, void *start_virt_addr,
+                                    uint32_t num_frames, uint32_t flags);
+// Unmaps consecutive 4KB pages from a process' page directory as part of a transaction
+void page_transaction_unmap_frames(page_transaction *transaction, void *start_virt_addr, uint32_t num_frames);
+// Gets the page table entry of a 4KB page in the given page directory
+uint32_t get_page_table_entry(uint32_t *page_directory, void *virt_addr);
+// Gets the frame that a 4KB page is mapped to in the given page directory
+int32_t get_mapped_frame(uint32_t *page_directory, void *virt_addr);
+// Flushes all the changes made in a transaction from the TLB at once
+void commit_page_transaction(page_transaction *transaction);
+
+// Creates a page directory for a process, which starts out with only the kernel's mappings
+uint32_t* create_page_directory();
+// Frees a page directory returned by create_page_directory
+void free_page_directory(uint32_t *page_directory);
+// Switches to the given page directory with a single write to CR3
+void load_page_directory(uint32_t *page_directory);
+// Returns the page directory that is currently in use
+uint32_t* get_page_directory();
+
+// The page directory containing only the kernel's mappings, which is used when no process is running
+extern uint32_t kernel_page_directory[PAGE_DIRECTORY_SIZE];
+
 // Returns the index of an unused 4MB page in physical memory and marks it used
 int32_t get_open_page();
+// Marks the unused page at the provided index as used
+int32_t claim_page(int32_t index);
 // Marks the page at the provided index as unused
 void free_page(int32_t index);
 
+// Returns the index of the first frame of an unused, aligned block of 2^order 4KB frames and marks it used
+int32_t alloc_frames(uint32_t order);
+// Marks a block of 2^order frames returned by alloc_frames as unused
+void free_frames(int32_t frame, uint32_t order);
+// Returns the index of the first of num_frames unused consecutive 4KB frames and marks them used
+int32_t alloc_contiguous_frames(uint32_t num_frames);
+// Marks consecutive frames as unused, such as those returned by alloc_contiguous_frames
+void free_contiguous_frames(int32_t frame, uint32_t num_frames);
+// Adds a reference to a used frame that is about to be shared by another page
+void share_frame(int32_t frame);
+// Removes a reference to a used frame, and marks it as unused once nothing references it
+void release_frame(int32_t frame);
+// Gets the number of pages that reference a used frame
+uint32_t get_frame_refcount(int32_t frame);
+// Returns the index of an unused 4KB frame that is filled with zeros and marks it used
+int32_t alloc_zeroed_frame();
+// Zeroes one more frame for alloc_zeroed_frame to hand out, if the pool of zeroed frames is not full
+int32_t refill_zeroed_frames();
+
 #endif /* _PAGING_H */
@@ -11,7 +11,7 @@ static struct spinlock_t pit_spin_lock = SPIN_LOCK_UNLOCKED;
 
 // Structure that stores a callback and associated information
 typedef struct callback_t {
-	void (*callback)(double);
+	void (*callback)(uint32_t);
 	int interval;
 	int counter;
 } callback_t;
@@ -20,18 +20,31 @@ typedef LIST_ITEM_ID(callback_t, callback_list_item) callback_list_item;
 
 callback_list_item *callback_list_head;
 
-// Precomputed interval to increment by so we don't have to do floating point division
-//  on every timer interrupt
-static double interval;
+// The number of ticks that the PIT is counting down until the next interrupt
+static uint32_t ticks_until_interrupt = 1;
 
 // Whether or not scheduling is occurring
 static int scheduling_enabled = 0;
 
-// Time elapsed from system startup
-double sys_time = 0.0;
+// Time elapsed from system startup, in timer ticks
+volatile uint32_t sys_time = 0;
+
+/*
+ * Writes a new countdown to the PIT, which starts counting down immediately
+ *
+ * INPUTS: reload_value: the number of PIT_BASE_FREQUENCY cycles to count down
+ */
+static void write_pit_countdown(uint16_t reload_value) {
+	// First write the bottom 8 bits
+	outb(reload_value & 0xFF, PIT_CHANNEL_0_DATA_PORT);
+	// Then the upper 8 bits
+	outb((reload_value >> 8) & 0xFF, PIT_CHANNEL_0_DATA_PORT);
+}
 
 /*
  * Initializes the Programmable Interval Timer to generate interrupts at a frequency of very close to 69 Hz
+ * With PIT_TICKLESS_ENABLE, the PIT is instead put in one-shot mode, and each interrupt programs the
+ *  next one for when something is due, so that no interrupts are taken while there is nothing to do
  */
 void init_pit() {
 	spin_lock(&pit_spin_lock);
@@ -45,20 +58,19 @@ void init_pit() {
 	enable_irq(TIMER_IRQ);
 
 	// Write the desired configuration to the PIT command port
+#ifdef PIT_TICKLESS_ENABLE
+	outb(PIT_CMD_CHANNEL_0 | PIT_CMD_ACCESS_MODE_LO_HI | PIT_CMD_MODE_0 | PIT_CMD_BINARY_MODE, PIT_CMD_REGISTER);
+#else
 	outb(PIT_CMD_CHANNEL_0 | PIT_CMD_ACCESS_MODE_LO_HI | PIT_CMD_MODE_2 | PIT_CMD_BINARY_MODE, PIT_CMD_REGISTER);
+#endif
 
-	// Write the countdown timer with the desired value
-	// First write the bottom 8 bits
-	outb(PIT_RELOAD_VALUE & 0xFF, PIT_CHANNEL_0_DATA_PORT);
-	// Then the upper 8 bits
-	outb((PIT_RELOAD_VALUE >> 8) & 0xFF, PIT_CHANNEL_0_DATA_PORT);
-
-	// Set the interval to be 1/frequency
-	interval = 1.0 / PIT_FREQUENCY;
+	// Write the countdown timer with the desired value, which is a single tick to start with
+	ticks_until_interrupt = 1;
+	write_pit_countdown(PIT_RELOAD_VALUE);
 }
 
 /*
- * Begins callbacks to scheduler_interrupt_handler at a rate of 69 Hz
+ * Begins callbacks to scheduler_interrupt_handler on every timer interrupt
  */
 void enable_scheduling() {
 	scheduling_enabled = 1;
@@ -75,7 +87,7 @@ void enable_scheduling() {
  *                   as a parameter
  * OUTPUTS: an id corresponding to the callback, or 0 on failure
  */
-uint32_t register_periodic_callback(int interval, void (*callback_fn)(double)) {
+uint32_t register_periodic_callback(int interval, void (*callback_fn)(uint32_t)) {
 	if (callback_fn == NULL)
 		return 0;
 
@@ -130,8 +142,35 @@ void unregister_periodic_callback(uint32_t id) {
 	spin_unlock(&pit_spin_lock);
 }
 
+/*
+ * Sets when the next timer interrupt happens, which is the earliest of the given deadline, the next
+ *  callback and the longest countdown the PIT can do
+ * Must be called once from every timer interrupt with interrupts disabled, since the countdown
+ *  restarts when it is written; without PIT_TICKLESS_ENABLE, this does nothing as every tick interrupts
+ *
+ * INPUTS: max_ticks: the number of ticks until the scheduler needs to run again, or 0 if it doesn't
+ */
+void set_next_timer_interrupt(uint32_t max_ticks) {
+#ifdef PIT_TICKLESS_ENABLE
+	uint32_t ticks = PIT_MAX_TICKS_PER_INTERRUPT;
+	if (max_ticks != 0 && max_ticks < ticks)
+		ticks = max_ticks;
+
+	callback_list_item *cur;
+	for (cur = callback_list_head; cur != NULL; cur = cur->next) {
+		if ((uint32_t)cur->data.counter < ticks)
+			ticks = cur->data.counter;
+	}
+
+	ticks_until_interrupt = ticks;
+	write_pit_countdown(ticks * PIT_RELOAD_VALUE);
+#endif
+}
+
 /*
  * Handler for the timer interrupt
+ * Every tick that passed since the last interrupt is accounted for, so time, callbacks and the
+ *  scheduler all behave the same as if the timer had interrupted on each tick
  */
 void timer_handler() {
 	// Set that we are not in userspace
@@ -139,24 +178,27 @@ void timer_handler() {
 
 	send_eoi(TIMER_IRQ);
 
-	sys_time += interval;
+	uint32_t ticks = ticks_until_interrupt;
+	sys_time += ticks;
 
 	// Go through all the handlers
 	callback_list_item *cur;
 	for (cur = callback_list_head; cur != NULL; cur = cur->next) {
 		// Decrement the counter
-		cur->data.counter--;
+		cur->data.counter -= ticks;
 
 		// Once the counter has reached zero, reset the counter and fire the callback
-		if (cur->data.counter == 0) {
+		if (cur->data.counter <= 0) {
 			cur->data.counter = cur->data.interval;
 			cur->data.callback(sys_time);
 		}
 	}
 
-	// Finally, run the scheduler
+	// Finally, run the scheduler, which sets up the next interrupt
 	if (scheduling_enabled)
-		scheduler_interrupt_handler();
+		scheduler_interrupt_handler(ticks);
+	else
+		set_next_timer_interrupt(0);
 
 	// Set that we are going back to userspace
 	in_userspace = 1;
@@ -3,6 +3,10 @@
 
 #include "types.h"
 
+// Comment out PIT_TICKLESS_ENABLE to have the PIT interrupt on every tick, rather than only when the
+//  next callback or the end of the current process' quantum is due
+#define PIT_TICKLESS_ENABLE
+
 // I/O ports for the Programmable Interval Timer
 //  The data ports are used to read/write the current value of the countdown for each channel
 //  The command register is used to set the mode of each channel
@@ -15,6 +19,8 @@
 	#define PIT_CMD_CHANNEL_0 0x0
 	// Specifies that both the low and high byte of the counter value will be read / written (sequentially)
 	#define PIT_CMD_ACCESS_MODE_LO_HI (0x3 << 4)
+	// Mode which specifies that we will get a single interrupt once the countdown reaches 0
+	#define PIT_CMD_MODE_0 (0x0 << 1)
 	// Mode which specifies that we will get interrupts at a constant rate
 	#define PIT_CMD_MODE_2 (0x2 << 1)
 	// Specifies that we will be using binary as opposed to BCD
@@ -26,25 +32,32 @@
 #define PIT_BASE_FREQUENCY 1193182
 // The reload value based off of the desired frequency and the base frequency
 #define PIT_RELOAD_VALUE (PIT_BASE_FREQUENCY / PIT_FREQUENCY)
+// The largest number of ticks that the PIT can count down at once, since its counter is 16 bits
+#define PIT_MAX_TICKS_PER_INTERRUPT (0xFFFF / PIT_RELOAD_VALUE)
 
 // Initializes the Programmable Interval Timer to generate interrupts at a frequency of very close to 69 Hz
 void init_pit();
 
-// Begins callbacks to scheduler_interrupt_handler at a rate of 69 Hz
+// Begins callbacks to scheduler_interrupt_handler on every timer interrupt
 void enable_scheduling();
 
+// Sets when the next timer interrupt happens, which is the earliest of the given deadline and the
+//  next callback
+void set_next_timer_interrupt(uint32_t max_ticks);
+
 // Handler for the timer interrupt
 void timer_handler();
 
 // Adds a callback to the list of callbacks that will be called at a periodic interval, returning
 //  an ID that will be used to deregister the callback
 // Callbacks must run quickly!
-uint32_t register_periodic_callback(int interval, void (*callback)(double));
+uint32_t register_periodic_callback(int interval, void (*callback)(uint32_t));
 
 // Unregisters a previously registered callback
 void unregister_periodic_callback(uint32_t id);
 
-// Global time from startup in seconds
-extern double sys_time;
+// Global time from startup in timer ticks, where each tick takes 1/PIT_FREQUENCY seconds
+// This is kept as an integer since the kernel does not save the FPU registers of processes around its own code
+extern volatile uint32_t sys_time;
 
 #endif
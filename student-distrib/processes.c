@@ -4,6 +4,7 @@
 #include "paging.h"
 #include "x86_desc.h"
 #include "kheap.h"
+#include "kernel_stack.h"
 #include "i8259.h"
 #include "interrupt_service_routines.h"
 #include "graphics/graphics.h"
@@ -11,6 +12,7 @@
 #include "window_manager/window_manager.h"
 #include "mouse.h"
 #include "network/udp.h"
+#include "pit.h"
 
 // A dynamic array indicating which PIDs are currently in use by running programs
 // Each index corresponds to a PID and contains a pointer to that process' PCB
@@ -44,6 +46,139 @@ static int shell_started[NUM_TEXT_TTYS];
 // The currently active TTY
 uint8_t active_tty = 1;
 
+// The processes that can run, other than the one that is currently running, with a queue for each
+//  priority level in the order that the scheduler will switch to them
+// These are set up by init_processes
+static wait_queue_t run_queues[NUM_PRIORITY_LEVELS];
+
+// The processes that have halted and are waiting to be freed, which cannot happen while their kernel
+//  stacks may still be in use (see reap_stopped_processes)
+static wait_queue_t stopped_processes = WAIT_QUEUE_EMPTY;
+
+// Set when a process of higher priority than the current one is woken up, so that it gets switched
+//  to when the interrupt that woke it up returns (see preempt_on_wakeup)
+static int32_t need_reschedule = 0;
+
+// The PID of the process whose registers are in the FPU, or -1 if there is none
+// CR0.TS is set whenever any other process is running, so that it faults if it uses the FPU
+static int32_t fpu_owner = -1;
+
+// The registers that every process starts with the first time it uses the FPU (see init_fpu)
+static uint8_t initial_fpu_state[FPU_STATE_SIZE] __attribute__((aligned (FPU_STATE_ALIGNMENT)));
+
+// The frames of the read-only part of an executable that at least one process is running, which are
+//  shared by all of the processes running it
+typedef struct resident_executable {
+	// The inode of the executable
+	int32_t inode;
+	// The number of processes whose memory regions include the executable's shared text
+	uint32_t num_users;
+	// The number of pages of shared text
+	uint32_t num_pages;
+	// The frame of each page, or -1 if no process has accessed the page yet
+	// The cache holds one reference to each of these frames, on top of the pages they are mapped to
+	int32_t *frames;
+} resident_executable;
+
+typedef DYNAMIC_ARRAY(resident_executable, resident_executable_dyn_arr) resident_executable_dyn_arr;
+
+// The executables that are currently running
+// This is only changed with interrupts disabled, either with pcb_spin_lock held or from the page
+//  fault handler, which cannot take pcb_spin_lock because it may run during a system call that holds it
+static resident_executable_dyn_arr resident_executables;
+
+// A segment of memory that any process can attach to by its key, which stays around until the last
+//  process attached to it detaches or halts
+typedef struct shared_segment {
+	// The key that processes attach to the segment by
+	int32_t key;
+	// The number of processes whose memory regions include the segment
+	uint32_t num_users;
+	// The number of pages in the segment
+	uint32_t num_pages;
+	// The frame of each page, or -1 if no process has accessed the page yet
+	// The segment holds one reference to each of these frames, on top of the pages they are mapped to
+	int32_t *frames;
+} shared_segment;
+
+typedef DYNAMIC_ARRAY(shared_segment, shared_segment_dyn_arr) shared_segment_dyn_arr;
+
+// The shared memory segments that exist, which are only changed with interrupts disabled like
+//  resident_executables
+static shared_segment_dyn_arr shared_segments;
+
+/*
+ * Sets bit 3 (TS) of CR0, so that the next FPU or SSE instruction raises the device not available exception
+ */
+static inline void set_task_switched() {
+	asm volatile ("       \n\
+		mov %%cr0, %%eax  \n\
+		or $0x8, %%eax    \n\
+		mov %%eax, %%cr0"
+		:
+		:
+		: "eax", "cc"
+	);
+}
+
+/*
+ * Clears bit 3 (TS) of CR0, so that FPU and SSE instructions run again
+ */
+static inline void clear_task_switched() {
+	asm volatile ("clts");
+}
+
+/*
+ * Saves the FPU and SSE registers to the given area, which must be FPU_STATE_ALIGNMENT aligned
+ */
+static inline void fxsave(void *state) {
+	asm volatile ("fxsave (%0)" : : "r"(state) : "memory");
+}
+
+/*
+ * Loads the FPU and SSE registers from the given area, which must be FPU_STATE_ALIGNMENT aligned
+ */
+static inline void fxrstor(void *state) {
+	asm volatile ("fxrstor (%0)" : : "r"(state) : "memory");
+}
+
+/*
+ * Enables the FPU and SSE for processes: bit 1 (MP) of CR0 is set and bit 2 (EM) is cleared so that
+ *  FPU instructions run and respect TS, bit 5 (NE) is set so that FPU errors raise exceptions, and
+ *  bits 9 (OSFXSR) and 10 (OSXMMEXCPT) of CR4 enable SSE and its exceptions
+ * The clean registers that every process starts with are saved, and then TS is set so that the first
+ *  time a process uses the FPU, it is given its own registers (see process_fpu_fault)
+ */
+static void init_fpu() {
+	uint32_t mxcsr = MXCSR_DEFAULT;
+	asm volatile ("            \n\
+		mov %%cr0, %%eax       \n\
+		and $~0xC, %%eax       \n\
+		or $0x22, %%eax        \n\
+		mov %%eax, %%cr0       \n\
+		mov %%cr4, %%eax       \n\
+		or $0x600, %%eax       \n\
+		mov %%eax, %%cr4       \n\
+		fninit                 \n\
+		ldmxcsr (%0)           \n\
+		xorps %%xmm0, %%xmm0   \n\
+		xorps %%xmm1, %%xmm1   \n\
+		xorps %%xmm2, %%xmm2   \n\
+		xorps %%xmm3, %%xmm3   \n\
+		xorps %%xmm4, %%xmm4   \n\
+		xorps %%xmm5, %%xmm5   \n\
+		xorps %%xmm6, %%xmm6   \n\
+		xorps %%xmm7, %%xmm7"
+		:
+		: "r"(&mxcsr)
+		: "eax", "cc", "memory"
+	);
+
+	fxsave(initial_fpu_state);
+	fpu_owner = -1;
+	set_task_switched();
+}
+
 /*
  * Initializes any supporting data structures for managing user level processes
  *
@@ -52,23 +187,37 @@ uint8_t active_tty = 1;
 int init_processes() {
 	// Initialize the PCB array
 	DYN_ARR_INIT(pcb_t, pcbs);
-	if (pcbs.data == NULL)
+	if (pcbs.data == NULL || DYN_ARR_RESERVE(pcb_t, pcbs, NUM_RESERVED_PCBS) != 0)
+		return -1;
+
+	DYN_ARR_INIT(resident_executable, resident_executables);
+	if (resident_executables.data == NULL)
+		return -1;
+
+	DYN_ARR_INIT(shared_segment, shared_segments);
+	if (shared_segments.data == NULL)
 		return -1;
 
-	// Create video memory buffers for the 3 text TTYs
-	// We will place each of them within its own page (12 MB total)
 	int i;
+	for (i = 0; i < NUM_PRIORITY_LEVELS; i++)
+		run_queues[i] = (wait_queue_t)WAIT_QUEUE_EMPTY;
+
+	init_fpu();
+
+	// Set aside memory for the kernel stacks of processes
+	if (init_kernel_stacks() != 0)
+		return -1;
+
+	// Create video memory buffers for the 3 text TTYs
+	// We will place each of them within its own page (12 MB total), which is reached through the
+	//  kernel's mapping of physical memory
 	for (i = 0; i < NUM_TTYS; i++) {
 		int32_t vid_mem_buffer_page = get_open_page();
 		if (vid_mem_buffer_page == -1)
 			return -1;
-		
-		// Map in the page
-		identity_map_containing_region((void*)(vid_mem_buffer_page * LARGE_PAGE_SIZE), LARGE_PAGE_SIZE,
-			PAGE_GLOBAL | PAGE_READ_WRITE);
-		
+
 		// Store a pointer to the buffer
-		vid_mem_buffers[i] = (void*)(vid_mem_buffer_page * LARGE_PAGE_SIZE);
+		vid_mem_buffers[i] = phys_to_virt(vid_mem_buffer_page * LARGE_PAGE_SIZE);
 	}
 
 	// Clear the TTYs that are not currently active
@@ -212,26 +361,30 @@ void *get_vid_mem(uint8_t tty) {
 }
 
 /*
- * Checks if the given region of memory lies within the memory assigned to the process with the given PID 
+ * Checks if the given region of memory lies within one of the memory regions of the process with the
+ *  given PID that has none of the given flags
  *
  * INPUTS: ptr: the base virtual address of the region of memory
  *         size: the size, in bytes of the region of memory
  *         pid: we are making sure the region lies within the memory assigned to the process with this PID
+ *         excluded_flags: memory regions with any of these flags (MEMORY_REGION_*) do not count
  * RETURNS: 0 if the region is valid and -1 otherwise
  */
-int8_t is_userspace_region_valid(void *ptr, uint32_t size, int32_t pid) {
+static int8_t check_userspace_region(void *ptr, uint32_t size, int32_t pid, uint32_t excluded_flags) {
 	spin_lock_irqsave(pcb_spin_lock);
 
 	pcb_t *pcb = get_pcb_from_pid(pid);
 
-	// Go through the list of allocated pages
+	// Go through the list of memory regions
 	int i;
-	for (i = 0; i < pcb->large_page_mappings.length; i++) {
-		uint32_t start_addr = pcb->large_page_mappings.data[i].virt_index * LARGE_PAGE_SIZE;
+	for (i = 0; i < pcb->memory_regions.length; i++) {
+		uint32_t start_addr = pcb->memory_regions.data[i].virt_addr;
+		uint32_t end_addr = start_addr + pcb->memory_regions.data[i].num_pages * NORMAL_PAGE_SIZE;
 
-		// Check if it is within the virtual address given by this page
+		// Check if it is within the virtual addresses of this region
 		if (((uint32_t)ptr >= start_addr) && 
-		    ((uint32_t)ptr + size < start_addr + LARGE_PAGE_SIZE)) {
+		    ((uint32_t)ptr + size <= end_addr) &&
+		    !(pcb->memory_regions.data[i].flags & excluded_flags)) {
 
 			spin_unlock_irqsave(pcb_spin_lock);
 			return 0;
@@ -242,6 +395,32 @@ int8_t is_userspace_region_valid(void *ptr, uint32_t size, int32_t pid) {
 	return -1;
 }
 
+/*
+ * Checks if the given region of memory lies within the memory assigned to the process with the given PID 
+ *
+ * INPUTS: ptr: the base virtual address of the region of memory
+ *         size: the size, in bytes of the region of memory
+ *         pid: we are making sure the region lies within the memory assigned to the process with this PID
+ * RETURNS: 0 if the region is valid and -1 otherwise
+ */
+int8_t is_userspace_region_valid(void *ptr, uint32_t size, int32_t pid) {
+	return check_userspace_region(ptr, size, pid, 0);
+}
+
+/*
+ * Checks if the given region of memory lies within memory of the process with the given PID that it is
+ *  allowed to write to, which must be checked before the kernel writes to it on behalf of the process
+ *  (writing to a read-only page from the kernel is not a fault that the process can recover from)
+ *
+ * INPUTS: ptr: the base virtual address of the region of memory
+ *         size: the size, in bytes of the region of memory
+ *         pid: we are making sure the region lies within the memory assigned to the process with this PID
+ * RETURNS: 0 if the region is writable and -1 otherwise
+ */
+int8_t is_userspace_region_writable(void *ptr, uint32_t size, int32_t pid) {
+	return check_userspace_region(ptr, size, pid, MEMORY_REGION_READ_ONLY);
+}
+
 /*
  * Checks if the given string lies within the memory assigned to the process with the given PID
  *
@@ -258,61 +437,486 @@ int8_t is_userspace_string_valid(void *ptr, int32_t pid) {
 }
 
 /*
- * Forcibly maps in the pages allocated to the process with given PID
+ * Finds the entry for an executable in resident_executables
  *
- * INPUTS: pid: the PID of the process whose pages we are paging in
- * OUTPUTS: -1 if the PID is invalid and 0 on success
+ * INPUTS: inode: the inode of the executable
+ * OUTPUTS: the index of the entry, or -1 if no process is running the executable
  */
-int32_t map_process(int32_t pid) {
-	spin_lock_irqsave(pcb_spin_lock);
+static int32_t find_resident_executable(int32_t inode) {
+	int32_t i;
+	for (i = 0; i < resident_executables.length; i++) {
+		if (resident_executables.data[i].inode == inode)
+			return i;
+	}
+	return -1;
+}
 
-	pcb_t *pcb = get_pcb_from_pid(pid);
-	if (pcb == NULL) {
-		spin_unlock_irqsave(pcb_spin_lock);
+/*
+ * Adds a user to the entry for an executable, creating the entry if no process is running it yet
+ *
+ * INPUTS: inode: the inode of the executable
+ *         num_pages: the number of pages of shared text that the executable has
+ * OUTPUTS: 0 on success, and -1 if the entry could not be allocated
+ */
+static int32_t get_resident_executable(int32_t inode, uint32_t num_pages) {
+	int32_t index = find_resident_executable(inode);
+	if (index != -1) {
+		resident_executables.data[index].num_users++;
+		return 0;
+	}
+
+	resident_executable executable;
+	executable.inode = inode;
+	executable.num_users = 1;
+	executable.num_pages = num_pages;
+	executable.frames = kmalloc(num_pages * sizeof(int32_t));
+	if (executable.frames == NULL)
+		return -1;
+
+	uint32_t page;
+	for (page = 0; page < num_pages; page++)
+		executable.frames[page] = -1;
+
+	if (DYN_ARR_PUSH(resident_executable, resident_executables, executable) < 0) {
+		kfree(executable.frames);
 		return -1;
 	}
+	return 0;
+}
 
-	// Iterate through all the large page mappings for this PID
-	int i;
-	for (i = 0; i < pcb->large_page_mappings.length; i++) {
-		// Unmap the region first, since map_region checks if the region is already paged in
-		unmap_region((void*)(pcb->large_page_mappings.data[i].virt_index * LARGE_PAGE_SIZE), 1);
-		// Map in the single 4MB region
-		map_region((void*)(pcb->large_page_mappings.data[i].phys_index * LARGE_PAGE_SIZE), 
-			(void*)(pcb->large_page_mappings.data[i].virt_index * LARGE_PAGE_SIZE), 
-			1, PAGE_READ_WRITE | PAGE_USER_LEVEL);
+/*
+ * Removes a user from the entry for an executable, releasing its frames once no process is running it
+ *
+ * INPUTS: inode: the inode of the executable
+ */
+static void put_resident_executable(int32_t inode) {
+	int32_t index = find_resident_executable(inode);
+	if (index == -1)
+		return;
+
+	resident_executable *executable = &resident_executables.data[index];
+	if (--executable->num_users > 0)
+		return;
+
+	uint32_t page;
+	for (page = 0; page < executable->num_pages; page++) {
+		if (executable->frames[page] != -1)
+			release_frame(executable->frames[page]);
 	}
+	kfree(executable->frames);
+	DYN_ARR_REMOVE(resident_executable, resident_executables, index);
+}
 
-	spin_unlock_irqsave(pcb_spin_lock);
+/*
+ * Finds a shared memory segment in shared_segments
+ *
+ * INPUTS: key: the key of the segment
+ * OUTPUTS: the index of the segment, or -1 if there is no segment with that key
+ */
+static int32_t find_shared_segment(int32_t key) {
+	int32_t i;
+	for (i = 0; i < shared_segments.length; i++) {
+		if (shared_segments.data[i].key == key)
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Creates a shared memory segment with a single user, whose pages are given frames when first accessed
+ *
+ * INPUTS: key: the key of the segment, which must not be in use
+ *         num_pages: the number of pages in the segment
+ * OUTPUTS: 0 on success, and -1 if the segment could not be allocated
+ */
+static int32_t create_shared_segment(int32_t key, uint32_t num_pages) {
+	shared_segment segment;
+	segment.key = key;
+	segment.num_users = 1;
+	segment.num_pages = num_pages;
+	segment.frames = kmalloc(num_pages * sizeof(int32_t));
+	if (segment.frames == NULL)
+		return -1;
+
+	uint32_t page;
+	for (page = 0; page < num_pages; page++)
+		segment.frames[page] = -1;
+
+	if (DYN_ARR_PUSH(shared_segment, shared_segments, segment) < 0) {
+		kfree(segment.frames);
+		return -1;
+	}
 	return 0;
 }
 
 /*
- * Forcibly unmaps the pages allocated to the process with given PID
+ * Removes a user from a shared memory segment, releasing its frames and its key once no process is
+ *  attached to it
  *
- * INPUTS: pid: the PID of the process whose pages we are unmapping
- * OUTPUTS: -1 if the PID is invalid and 0 on success
+ * INPUTS: key: the key of the segment
  */
-int32_t unmap_process(int32_t pid) {
-	spin_lock_irqsave(pcb_spin_lock);
+static void put_shared_segment(int32_t key) {
+	int32_t index = find_shared_segment(key);
+	if (index == -1)
+		return;
 
-	pcb_t *pcb = get_pcb_from_pid(pid);
-	if (pcb == NULL) {
-		spin_unlock_irqsave(pcb_spin_lock);
+	shared_segment *segment = &shared_segments.data[index];
+	if (--segment->num_users > 0)
+		return;
+
+	uint32_t page;
+	for (page = 0; page < segment->num_pages; page++) {
+		if (segment->frames[page] != -1)
+			release_frame(segment->frames[page]);
+	}
+	kfree(segment->frames);
+	DYN_ARR_REMOVE(shared_segment, shared_segments, index);
+}
+
+/*
+ * Gives a page that was shared after fork its own copy of its frame, and makes it writable again
+ * If no other process references the frame anymore, the frame is simply made writable
+ *
+ * INPUTS: pcb: the process that wrote to the page
+ *         page_addr: the virtual address of the page
+ *         old_frame: the frame that the page is mapped to
+ * OUTPUTS: 0 on success and -1 if there was no memory for the copy
+ */
+static int32_t copy_on_write(pcb_t *pcb, uint32_t page_addr, int32_t old_frame) {
+	int32_t frame = old_frame;
+	if (get_frame_refcount(old_frame) > 1) {
+		frame = alloc_frames(0);
+		if (frame == -1)
+			return -1;
+		memcpy(phys_to_virt(frame * NORMAL_PAGE_SIZE), phys_to_virt(old_frame * NORMAL_PAGE_SIZE), NORMAL_PAGE_SIZE);
+	}
+
+	// The read-only entry may be in the TLB, which committing flushes
+	page_transaction transaction;
+	begin_page_transaction(&transaction, pcb->page_directory);
+	page_transaction_map_frames(&transaction, frame, (void*)page_addr, 1, PAGE_READ_WRITE | PAGE_USER_LEVEL);
+	commit_page_transaction(&transaction);
+
+	if (frame != old_frame)
+		release_frame(old_frame);
+
+	return 0;
+}
+
+/*
+ * Allocates a frame filled with the contents of a page of a memory region, copying only the part of
+ *  the file that is in the page and zeroing the rest
+ * Pages that have nothing from the file in them are taken from the pool of frames that were zeroed
+ *  ahead of time, so that stacks and .bss do not have to be cleared while the process waits
+ *
+ * INPUTS: region: the memory region that the page is in
+ *         page_addr: the virtual address of the page
+ * OUTPUTS: the index of the frame, or -1 if there is not enough memory or the file could not be read
+ */
+static int32_t alloc_filled_frame(memory_region *region, uint32_t page_addr) {
+	uint32_t offset = page_addr - region->virt_addr;
+	int32_t num_file_bytes = 0;
+	if (region->inode != -1 && offset < region->file_size)
+		num_file_bytes = (region->file_size - offset < NORMAL_PAGE_SIZE) ? region->file_size - offset : NORMAL_PAGE_SIZE;
+
+	if (num_file_bytes == 0)
+		return alloc_zeroed_frame();
+
+	int32_t frame = alloc_frames(0);
+	if (frame == -1)
+		return -1;
+
+	// The frame is written through the kernel's mapping of physical memory
+	uint8_t *page = phys_to_virt(frame * NORMAL_PAGE_SIZE);
+	if (read_data(region->inode, region->file_offset + offset, page, num_file_bytes) != num_file_bytes) {
+		free_frames(frame, 0);
 		return -1;
 	}
+	memset(page + num_file_bytes, 0, NORMAL_PAGE_SIZE - num_file_bytes);
+	return frame;
+}
+
+/*
+ * Gives a frame to the page of the current process that was accessed, if the page is part of one of
+ *  its memory regions and has not been accessed before, filling it from the file that the region is
+ *  backed by or with zeros, or mapping the frame of shared text that another process filled in
+ * This is called by the page fault handler, both for accesses made by the process and for accesses
+ *  made by the kernel to the process' memory during system calls
+ * The PCB is not locked, since the memory regions of a process cannot change while it is faulting
+ *
+ * INPUTS: addr: the address that could not be accessed
+ * OUTPUTS: 0 if the page was filled in so that the access can be retried, and -1 if the access was invalid
+ */
+int32_t process_page_fault(void *addr) {
+	int32_t pid = get_pid();
+	if (pid < 0 || pid >= pcbs.length)
+		return -1;
+
+	// The fault must be in the memory of the process whose page directory is in use
+	pcb_t *pcb = &pcbs.data[pid];
+	if (pcb->pid != pid || pcb->page_directory != get_page_directory())
+		return -1;
 
-	// Iterate through all the large page mappings for this PID
+	// Find the memory region that contains the page
+	uint32_t page_addr = (uint32_t)addr & PAGE_ADDR_MASK;
+	memory_region *region = NULL;
 	int i;
-	for (i = 0; i < pcb->large_page_mappings.length; i++) {
-		// Unmap the region first, since map_region checks if the region is already paged in
-		unmap_region((void*)(pcb->large_page_mappings.data[i].virt_index * LARGE_PAGE_SIZE), 1);
+	for (i = 0; i < pcb->memory_regions.length; i++) {
+		memory_region *cur = &pcb->memory_regions.data[i];
+		if (page_addr >= cur->virt_addr && page_addr < cur->virt_addr + cur->num_pages * NORMAL_PAGE_SIZE) {
+			region = cur;
+			break;
+		}
 	}
 
-	spin_unlock_irqsave(pcb_spin_lock);
+	if (region == NULL)
+		return -1;
+
+	// A page that is already present was either written to while shared after fork, or accessed in
+	//  a way that it does not allow
+	uint32_t pte = get_page_table_entry(pcb->page_directory, (void*)page_addr);
+	if (pte & PAGE_PRESENT)
+		return (pte & PAGE_COPY_ON_WRITE) ? copy_on_write(pcb, page_addr, pte / NORMAL_PAGE_SIZE) : -1;
+
+	// Pages of shared text are mapped read-only to the frame that every process running the
+	//  executable uses, which is only filled in by the first of them to access the page
+	uint32_t page = (page_addr - region->virt_addr) / NORMAL_PAGE_SIZE;
+	int32_t frame;
+	uint32_t flags = (region->flags & MEMORY_REGION_READ_ONLY) ? PAGE_USER_LEVEL : PAGE_READ_WRITE | PAGE_USER_LEVEL;
+	if (region->flags & MEMORY_REGION_SHARED_TEXT) {
+		int32_t index = find_resident_executable(region->inode);
+		if (index == -1)
+			return -1;
+
+		frame = resident_executables.data[index].frames[page];
+		if (frame == -1) {
+			frame = alloc_filled_frame(region, page_addr);
+			if (frame == -1)
+				return -1;
+			resident_executables.data[index].frames[page] = frame;
+		}
+		share_frame(frame);
+	} else if (region->flags & MEMORY_REGION_SHARED_MEMORY) {
+		// Pages of shared memory are mapped to the segment's frame, which is zeroed when first accessed
+		int32_t index = find_shared_segment(region->inode);
+		if (index == -1)
+			return -1;
+
+		frame = shared_segments.data[index].frames[page];
+		if (frame == -1) {
+			frame = alloc_zeroed_frame();
+			if (frame == -1)
+				return -1;
+			shared_segments.data[index].frames[page] = frame;
+		}
+		share_frame(frame);
+	} else if (region->flags & MEMORY_REGION_FILE_MAPPED) {
+		// The page is the block of the file system image that holds it, so nothing is copied
+		frame = fs_data_block_frame(region->inode, region->file_offset + page * NORMAL_PAGE_SIZE);
+		if (frame == -1)
+			return -1;
+	} else {
+		frame = alloc_filled_frame(region, page_addr);
+		if (frame == -1)
+			return -1;
+	}
+
+	// The page was not present, so committing does not need to flush anything
+	page_transaction transaction;
+	begin_page_transaction(&transaction, pcb->page_directory);
+	if (page_transaction_map_frames(&transaction, frame, (void*)page_addr, 1, flags) != 0) {
+		commit_page_transaction(&transaction);
+		if (!(region->flags & MEMORY_REGION_FILE_MAPPED))
+			release_frame(frame);
+		return -1;
+	}
+	commit_page_transaction(&transaction);
+
+	return 0;
+}
+
+/*
+ * Reads what is needed to start an executable without loading any of it: the regions that it takes up
+ *  in memory, which are the file plus any memory that its segments need past the end of the file
+ *  (such as .bss), and its entrypoint
+ * The image is split at the first page of a writable segment: the pages before it are the program's
+ *  text, which is shared read-only by every process running the executable, and the pages from it
+ *  onwards are its data, which each process gets its own copy of
+ *
+ * INPUTS: name: the filename of the executable
+ *         text: filled in with the memory region of the executable's text, with no pages if it has none
+ *         data: filled in with the memory region of the executable's data, with no pages if it has none
+ *         entrypoint: filled in with the virtual address that the executable starts at
+ * OUTPUTS: 0 on success, and -1 if the file does not exist, is not an executable, or is too large
+ */
+static int32_t read_executable(const char *name, memory_region *text, memory_region *data, void **entrypoint) {
+	dentry_t dentry;
+	elf_header header;
+	if (read_dentry_by_name((uint8_t*)name, &dentry) == -1 ||
+	    read_data(dentry.inode, 0, (uint8_t*)&header, sizeof(elf_header)) != sizeof(elf_header))
+		return -1;
+	if (*(uint32_t*)header.ident != ELF_MAGIC)
+		return -1;
+
+	// The file is loaded as is, so the segments are where their virtual addresses say they are
+	uint32_t image_start = EXECUTABLE_VIRT_PAGE_START + EXECUTABLE_PAGE_OFFSET;
+	uint32_t file_size = fs_size((int8_t*)name);
+	uint32_t size = file_size;
+	uint32_t text_size = MAX_IMAGE_SIZE;
+	uint32_t i;
+	for (i = 0; i < header.phnum; i++) {
+		elf_program_header program_header;
+		if (read_data(dentry.inode, header.phoff + i * header.phentsize, (uint8_t*)&program_header,
+				sizeof(elf_program_header)) != sizeof(elf_program_header))
+			return -1;
+
+		if (program_header.type != ELF_PT_LOAD || program_header.vaddr < image_start)
+			continue;
+
+		if (program_header.vaddr + program_header.memsz - image_start > size)
+			size = program_header.vaddr + program_header.memsz - image_start;
+		if ((program_header.flags & ELF_PF_W) &&
+		    (program_header.vaddr & PAGE_ADDR_MASK) - image_start < text_size)
+			text_size = (program_header.vaddr & PAGE_ADDR_MASK) - image_start;
+	}
+
+	if (size > MAX_IMAGE_SIZE)
+		return -1;
+
+	// Without a writable segment, the whole image is text
+	uint32_t num_pages = (size + NORMAL_PAGE_SIZE - 1) / NORMAL_PAGE_SIZE;
+	if (text_size > num_pages * NORMAL_PAGE_SIZE)
+		text_size = num_pages * NORMAL_PAGE_SIZE;
+
+	text->virt_addr = image_start;
+	text->num_pages = text_size / NORMAL_PAGE_SIZE;
+	text->inode = dentry.inode;
+	text->file_offset = 0;
+	text->file_size = (file_size < text_size) ? file_size : text_size;
+	text->flags = MEMORY_REGION_SHARED_TEXT | MEMORY_REGION_READ_ONLY;
+
+	data->virt_addr = image_start + text_size;
+	data->num_pages = num_pages - text->num_pages;
+	data->inode = dentry.inode;
+	data->file_offset = text_size;
+	data->file_size = (file_size > text_size) ? file_size - text_size : 0;
+	data->flags = 0;
+
+	*entrypoint = (void*)header.entry;
 	return 0;
 }
 
+/*
+ * Adds a process to the end of a queue of processes, which it must not already be in
+ * The PCB must be locked by the caller
+ *
+ * INPUTS: queue: the queue to add the process to
+ *         pid: the PID of the process
+ */
+static void queue_push(wait_queue_t *queue, int32_t pid) {
+	pcb_t *pcb = &pcbs.data[pid];
+	pcb->wait_queue = queue;
+	pcb->next_waiter = -1;
+	if (queue->tail == -1)
+		queue->head = pid;
+	else
+		pcbs.data[queue->tail].next_waiter = pid;
+	queue->tail = pid;
+}
+
+/*
+ * Removes the process at the front of a queue of processes
+ * The PCB must be locked by the caller
+ *
+ * INPUTS: queue: the queue to take the process from
+ * OUTPUTS: the PID of the process, or -1 if the queue is empty
+ */
+static int32_t queue_pop(wait_queue_t *queue) {
+	int32_t pid = queue->head;
+	if (pid == -1)
+		return -1;
+
+	pcb_t *pcb = &pcbs.data[pid];
+	queue->head = pcb->next_waiter;
+	if (queue->head == -1)
+		queue->tail = -1;
+
+	pcb->wait_queue = NULL;
+	pcb->next_waiter = -1;
+	return pid;
+}
+
+/*
+ * Marks a process that was not running as running, and adds it to the end of the run queue for its
+ *  priority unless it is the current process (which may be woken up before it has switched away, or
+ *  while it is idling)
+ * The PCB must be locked by the caller
+ *
+ * INPUTS: pid: the PID of the process
+ */
+static void make_runnable(int32_t pid) {
+	pcbs.data[pid].state = PROCESS_RUNNING;
+	if (pid != get_pid())
+		queue_push(&run_queues[pcbs.data[pid].priority], pid);
+}
+
+/*
+ * Removes the process at the front of the highest priority run queue that is not empty, looking only
+ *  at the given level and the ones above it
+ * The PCB must be locked by the caller
+ *
+ * INPUTS: lowest_level: the lowest priority level to take a process from
+ * OUTPUTS: the PID of the process, or -1 if all of those run queues are empty
+ */
+static int32_t pop_runnable(int32_t lowest_level) {
+	int32_t level, pid;
+	for (level = 0; level <= lowest_level; level++) {
+		if ((pid = queue_pop(&run_queues[level])) != -1)
+			return pid;
+	}
+	return -1;
+}
+
+/*
+ * Sets the priority of a process and gives it a full quantum at that priority
+ *
+ * INPUTS: pcb: the process
+ *         priority: the new priority level
+ */
+static void set_priority(pcb_t *pcb, uint8_t priority) {
+	pcb->priority = priority;
+	pcb->ticks_left = PRIORITY_QUANTUM(priority);
+}
+
+/*
+ * Removes a process from the queue that it is in, if any, so that it is never woken up or switched to
+ * The PCB must be locked by the caller
+ *
+ * INPUTS: pcb: the process to remove
+ */
+static void leave_wait_queue(pcb_t *pcb) {
+	wait_queue_t *queue = pcb->wait_queue;
+	if (queue == NULL)
+		return;
+
+	// Find the process before this one, if any
+	int32_t prev = -1, cur;
+	for (cur = queue->head; cur != -1 && cur != pcb->pid; cur = pcbs.data[cur].next_waiter)
+		prev = cur;
+
+	if (cur != -1) {
+		if (prev == -1)
+			queue->head = pcb->next_waiter;
+		else
+			pcbs.data[prev].next_waiter = pcb->next_waiter;
+		if (queue->tail == pcb->pid)
+			queue->tail = prev;
+	}
+
+	pcb->wait_queue = NULL;
+	pcb->next_waiter = -1;
+}
+
 /*
  * Frees the resources consumed by the process of given PID and removes it from the PCBs array
  * WARNING: in general, the process cannot be the one whose kernel stack we are currently running on
@@ -331,6 +935,17 @@ int32_t free_pid(int32_t pid) {
 
 	pcb_t *pcb = get_pcb_from_pid(pid);
 
+	// Make sure that nothing wakes the process up once its PID is reused
+	leave_wait_queue(pcb);
+
+	// The registers in the FPU are not saved anywhere once the process is gone
+	if (fpu_owner == pid) {
+		fpu_owner = -1;
+		set_task_switched();
+	}
+	kfree(pcb->fpu_state);
+	pcb->fpu_state = NULL;
+
 	// Store the top of the kernel stack and the current TTY
 	void *kernel_stack_top = pcb->kernel_stack_base - KERNEL_STACK_SIZE;
 
@@ -342,18 +957,35 @@ int32_t free_pid(int32_t pid) {
 	}
 	DYN_ARR_DELETE(pcb->files);
 
-	// Free all the pages for this process
-	for (i = 0; i < pcb->large_page_mappings.length; i++)
-		free_page(pcb->large_page_mappings.data[i].phys_index);
+	// Remove the windows of this process before their memory is freed, so that they are no longer drawn
+	destroy_windows_by_pid(pcb->pid);
 
-	// Free the page mapping dynamic array
-	DYN_ARR_DELETE(pcb->large_page_mappings);
+	// Release the frames of all the pages that this process has accessed, which are freed unless they
+	//  are still shared with another process after fork (files mapped straight from the file system
+	//  image have no frames of their own)
+	for (i = 0; i < pcb->memory_regions.length; i++) {
+		memory_region *region = &pcb->memory_regions.data[i];
+		uint32_t page;
+		for (page = 0; page < region->num_pages && !(region->flags & MEMORY_REGION_FILE_MAPPED); page++) {
+			int32_t frame = get_mapped_frame(pcb->page_directory, (void*)(region->virt_addr + page * NORMAL_PAGE_SIZE));
+			if (frame != -1)
+				release_frame(frame);
+		}
 
-	// Free the kernel stack for this process
-	kfree(kernel_stack_top);
+		// The frames of shared text are only freed once no other process is running the executable
+		if (region->flags & MEMORY_REGION_SHARED_TEXT)
+			put_resident_executable(region->inode);
+		// Likewise, shared memory is only freed once every process attached to it is done with it
+		if (region->flags & MEMORY_REGION_SHARED_MEMORY)
+			put_shared_segment(region->inode);
+	}
 
-	// Free all window memory here
-	destroy_windows_by_pid(pcb->pid);
+	// Free the memory region dynamic array and the page directory
+	DYN_ARR_DELETE(pcb->memory_regions);
+	free_page_directory(pcb->page_directory);
+
+	// Free the kernel stack for this process
+	free_kernel_stack(kernel_stack_top);
 
 	// Mark the current PID as unused and attempt to remove items from the end of the pcbs array
 	pcb->pid = -1;
@@ -371,6 +1003,36 @@ int32_t free_pid(int32_t pid) {
 	return 0;
 }
 
+/*
+ * Frees the processes that have halted, except for the current process, whose kernel stack is in use
+ * This is done whenever a new process is started (so that the PIDs and memory of halted processes are
+ *  reused) and whenever the processor is idle, rather than in the timer interrupt
+ */
+static void reap_stopped_processes() {
+	int32_t cur_pid = get_pid();
+	int32_t pid, skipped = 0;
+
+	while (1) {
+		spin_lock_irqsave(pcb_spin_lock);
+		pid = queue_pop(&stopped_processes);
+		spin_unlock_irqsave(pcb_spin_lock);
+
+		if (pid == -1)
+			break;
+		if (pid == cur_pid)
+			skipped = 1;
+		else
+			free_pid(pid);
+	}
+
+	// The current process is freed once another process is running
+	if (skipped) {
+		spin_lock_irqsave(pcb_spin_lock);
+		queue_push(&stopped_processes, cur_pid);
+		spin_unlock_irqsave(pcb_spin_lock);
+	}
+}
+
 /*
  * Halts the current process and returns the provided status code to the parent process
  * INPUTS: status: the status with which the program existed (256 for exception, [0-256) otherwise)
@@ -389,8 +1051,8 @@ int32_t process_halt(uint16_t status) {
 	if (pcb->parent_pid == -1) {
 		// Store the TTY
 		uint8_t tty = pcb->tty;
-		// Unmap the pages allocated to this process
-		unmap_process(pcb->pid);
+		// Switch to the kernel's page directory, since the page directory of this process is about to be freed
+		load_page_directory(kernel_page_directory);
 		// Free the PCB and all associated data
 		// Notice that this also frees the kernel stack that we are currently on
 		// However, interrupts are disabled due to the spin_lock_irqsave, and will remain disabled
@@ -400,20 +1062,25 @@ int32_t process_halt(uint16_t status) {
 		process_execute("shell", 0, tty, 0);
 	}
 
-	// Set the parent process as RUNNING instead of SLEEPING
-	parent_pcb->state = PROCESS_RUNNING;
-	// Set the current process as STOPPING
-	pcb->state = PROCESS_STOPPING;
+	// A process created by fork has no parent blocking on it, so there is no one to return the status to
+	if (!pcb->forked) {
+		// Set the parent process as RUNNING instead of SLEEPING
+		make_runnable(parent_pcb->pid);
+
+		// Set the blocking call data in the parent PCB to the status code
+		parent_pcb->blocking_call.data = status;
+	}
 
-	// Set the blocking call data in the parent PCB to the status code
-	parent_pcb->blocking_call.data = status;
+	// Set the current process as STOPPING, to be freed once we have switched away from it
+	pcb->state = PROCESS_STOPPING;
+	queue_push(&stopped_processes, pcb->pid);
 
 	// Unlock the pcb spinlock now that we are done using it
 	spin_unlock_irqsave(pcb_spin_lock);
 
-	// Spin and wait for scheduler
-	sti();
-	while (1);
+	// Switch away for good, and let the scheduler free this process once it is off its kernel stack
+	while (1)
+		schedule();
 
 	// Placeholder to get gcc to shut up
 	return 0;
@@ -457,6 +1124,9 @@ int32_t process_execute(const char *command, uint8_t has_parent, uint8_t tty, ui
 		has_arguments = i > start_of_arg;
 	}
 
+	// Free any processes that have halted, so that their PIDs and memory can be reused
+	reap_stopped_processes();
+
 	// Get the PID for this process
 	int32_t cur_pid = get_open_pid();
 	if (cur_pid < 0)
@@ -477,43 +1147,47 @@ int32_t process_execute(const char *command, uint8_t has_parent, uint8_t tty, ui
 		parent_pcb->blocking_call.type = BLOCKING_CALL_PROCESS_EXEC;
 	}
 
-	// Get a physical 4MB page for the executable
-	int page_index = get_open_page();	
-
-	// Get the memory address where the executable will be placed and the page that contains it
-	void *program_page = (void*)(LARGE_PAGE_SIZE * page_index);
-	void *virt_prog_page = (void*)EXECUTABLE_VIRT_PAGE_START;
-	void *virt_prog_location = (void*)EXECUTABLE_VIRT_PAGE_START + EXECUTABLE_PAGE_OFFSET;
-
-	// Forcibly page in the memory region where the executable will be located so that we can write the executable
-	// First, unmap the parent process' memory if has_parent is true OR if save_context is true
-	if (has_parent || save_context)
-		unmap_process(parent_pcb->pid);
-	// Then, map in the single 4MB page for this process
-	map_region(program_page, virt_prog_page, 1, PAGE_READ_WRITE | PAGE_USER_LEVEL);
-
-	// Load the executable into memory at the address corresponding to the PID
-	if (fs_load(name, virt_prog_location) != 0) {
+	// Find where the executable goes in memory, without loading any of it
+	// Its pages are only filled in from the file system when they are first accessed (see process_page_fault),
+	//  so the program starts right away no matter how large it is
+	memory_region text, data, stack;
+	void *entrypoint;
+	int32_t read_failed = read_executable(name, &text, &data, &entrypoint);
+
+	// The stack is zero-filled as it is accessed
+	stack.virt_addr = USER_STACK_TOP - USER_STACK_SIZE;
+	stack.num_pages = USER_STACK_SIZE / NORMAL_PAGE_SIZE;
+	stack.inode = -1;
+	stack.file_offset = 0;
+	stack.file_size = 0;
+	stack.flags = 0;
+
+	// Create the page directory for the new process, which starts out with none of the process' pages mapped
+	uint32_t *page_directory = create_page_directory();
+
+	// Check that the executable is valid and the page directory was allocated, and share the text
+	//  of the executable with any other process that is running it
+	int32_t shared_text_inode = -1;
+	if (read_failed || page_directory == NULL)
 		goto process_execute_fail;
+	if (text.num_pages > 0) {
+		if (get_resident_executable(text.inode, text.num_pages) != 0)
+			goto process_execute_fail;
+		shared_text_inode = text.inode;
 	}
 
-	// Check that the magic number is present
-	if (*(uint32_t*)virt_prog_location != ELF_MAGIC) {
-		goto process_execute_fail;
-	}
-
-	// Get the entrypoint of the executable (virtual address) from the program data
-	void *entrypoint = *((void**)(EXECUTABLE_VIRT_PAGE_START + EXECUTABLE_PAGE_OFFSET + ENTRYPOINT_OFFSET));
+	// Switch to the new page directory, which the process' pages will be filled into as it runs
+	load_page_directory(page_directory);
 
-	// Set the stack pointer for the new program to just point to the top of the program
-	void *program_esp = virt_prog_page + LARGE_PAGE_SIZE - 1;
+	// Set the stack pointer for the new program to just point to the top of its stack
+	void *program_esp = (void*)USER_STACK_TOP - 1;
 
 	// Set the TSS's SS0 and ESP0 fields
 	// SS0 should point to the kernel's stack segment
 	tss.ss0 = KERNEL_DS;
 	// ESP0 should point to the 8KB kernel stack for this process
-	//  which we will allocate now (must be 8KB aligned as well)
-	void *kernel_stack_base = kmalloc_aligned(KERNEL_STACK_SIZE, KERNEL_STACK_SIZE) + KERNEL_STACK_SIZE;
+	//  which we will allocate now from the kernel stack pool (which keeps it 8KB aligned as well)
+	void *kernel_stack_base = alloc_kernel_stack() + KERNEL_STACK_SIZE;
 	tss.esp0 = (uint32_t)kernel_stack_base;
 	// Check for null as with any dynamic allocation
 	if (tss.esp0 == KERNEL_STACK_SIZE) {
@@ -532,7 +1206,17 @@ int32_t process_execute(const char *command, uint8_t has_parent, uint8_t tty, ui
 	pcb->tty = parent_tty;
 	pcb->state = PROCESS_RUNNING;
 	pcb->parent_pid = parent_pid;
+	pcb->forked = 0;
 	pcb->kernel_stack_base = kernel_stack_base;
+	pcb->page_directory = page_directory;
+	pcb->next_window_addr = WINDOW_VIRT_START;
+	pcb->next_mmap_addr = MMAP_VIRT_START;
+	pcb->wait_queue = NULL;
+	pcb->next_waiter = -1;
+	pcb->fpu_state = NULL;
+	// The process starts at the base priority of the process that started it
+	pcb->base_priority = has_parent ? parent_pcb->base_priority : DEFAULT_PRIORITY;
+	set_priority(pcb, pcb->base_priority);
 
 	// Initialize the signal_handlers to NULL and signal_statuses to SIGNAL_OPEN
 	for (i = 0; i < NUM_SIGNALS; i++) {
@@ -554,7 +1238,7 @@ int32_t process_execute(const char *command, uint8_t has_parent, uint8_t tty, ui
 	// Then, initialize the files dynamic array and add the two elements, checking all allocations on the way
 	DYN_ARR_INIT(file_t, pcb->files);
 	if (pcb->files.data == NULL) {
-		kfree(kernel_stack_base - KERNEL_STACK_SIZE);
+		free_kernel_stack(kernel_stack_base - KERNEL_STACK_SIZE);
 		goto process_execute_fail;
 	}
 	// Adds the two elements, relying on short circuit evaluation to break if pushing fails
@@ -563,25 +1247,27 @@ int32_t process_execute(const char *command, uint8_t has_parent, uint8_t tty, ui
 		DYN_ARR_PUSH(file_t, pcb->files, mouse_file) < 0 ||
 		DYN_ARR_PUSH(file_t, pcb->files, udp_file) < 0) {
 
-		kfree(kernel_stack_base - KERNEL_STACK_SIZE);
+		free_kernel_stack(kernel_stack_base - KERNEL_STACK_SIZE);
 		DYN_ARR_DELETE(pcb->files);
 		goto process_execute_fail;
 	}
 
-	// Initialize the large_page_mappings array
-	DYN_ARR_INIT(page_mapping, pcb->large_page_mappings);
+	// Initialize the memory_regions array with room for the executable's text and data and the stack
+	DYN_ARR_INIT(memory_region, pcb->memory_regions);
 	// Check for NULL and free all previously allocated memory if so
-	if (pcb->large_page_mappings.data == NULL) {
-		kfree(kernel_stack_base - KERNEL_STACK_SIZE);
+	if (pcb->memory_regions.data == NULL || DYN_ARR_RESERVE(memory_region, pcb->memory_regions, 3) != 0) {
+		free_kernel_stack(kernel_stack_base - KERNEL_STACK_SIZE);
 		DYN_ARR_DELETE(pcb->files);
+		DYN_ARR_DELETE(pcb->memory_regions);
 		goto process_execute_fail;
 	}
-	// Add one entry for the single page allocated to this process
-	page_mapping page;
-	page.virt_index = EXECUTABLE_VIRT_PAGE_START / LARGE_PAGE_SIZE;
-	page.phys_index = page_index;
-	// This call cannot fail because dynamic arrays are initialized with a non-zero capacity
-	DYN_ARR_PUSH(page_mapping, pcb->large_page_mappings, page);
+	// Add an entry for each part of the executable that has pages, and one for the stack
+	// These calls cannot fail because room for all of them was reserved above
+	if (text.num_pages > 0)
+		DYN_ARR_PUSH(memory_region, pcb->memory_regions, text);
+	if (data.num_pages > 0)
+		DYN_ARR_PUSH(memory_region, pcb->memory_regions, data);
+	DYN_ARR_PUSH(memory_region, pcb->memory_regions, stack);
 	
 	// Copy the arguments into the PCB
 	if (has_arguments) {
@@ -606,6 +1292,14 @@ int32_t process_execute(const char *command, uint8_t has_parent, uint8_t tty, ui
 	if (save_context)
 		parent_pcb->context.eip = (uint32_t)(&&process_execute_return);
 
+	// A process that is not waiting for the new one is switched away from here, so it goes back into
+	//  the run queue if it can still run
+	if (!has_parent && save_context && parent_pcb->state == PROCESS_RUNNING)
+		queue_push(&run_queues[parent_pcb->priority], parent_pcb->pid);
+
+	// The new process does not get the FPU registers of the process that used the FPU last
+	set_task_switched();
+
 	// We intentionally do not unlock pcb_spin_lock because it will get unlocked (read: sti will be called)
 	//  when the jump into userspace occurs
 
@@ -654,16 +1348,14 @@ process_execute_return:
 
 	// An idiomatic way to use gotos in C is error handling
 process_execute_fail:
-	// Unmap the memory mapped in for this process
-	unmap_region(virt_prog_page, 1);
+	// Switch back to the page directory of the process that was running, or the kernel's if there was none
+	load_page_directory((has_parent || save_context) ? parent_pcb->page_directory : kernel_page_directory);
 
-	// Mark the page set aside for this process as unused
-	free_page(page_index);
+	// Free the page directory (none of the process' pages have been accessed, so there are no frames to free)
+	free_page_directory(page_directory);
 
-	// Map in the memory for the parent process
-	// Note that this doesn't make sense for the first process, which has no parent,
-	//  so we better not arrive here when we're launching the first process
-	map_process(parent_pid);
+	if (shared_text_inode != -1)
+		put_resident_executable(shared_text_inode);
 
 	// Mark the parent process as running again
 	parent_pcb->state = PROCESS_RUNNING;
@@ -680,60 +1372,479 @@ process_execute_fail:
 }
 
 /*
- * Marks the provided process as asleep and spins until the current quantum is complete,
- *  in the case that the current quantum is the process being put to sleep
+ * Creates a copy of the current process, which returns 0 from the fork system call while the current
+ *  process gets the PID of the copy
+ * Rather than copying the memory of the process, every page that has been accessed is shared read-only
+ *  by both processes and copied by whichever one writes to it first (see copy_on_write), and pages
+ *  that have not been accessed yet are filled in separately by each of them
+ * The copy runs alongside the current process, which does not wait for it to halt
  *
- * INPUTS: pid: the PID of the process to put to sleep
- * OUTPUTS: 0 on success, which is always 
+ * OUTPUTS: the PID of the new process, or -1 on failure
  */
-int32_t process_sleep(int32_t pid) {
+int32_t process_fork() {
+	// Free any processes that have halted, so that their PIDs and memory can be reused
+	reap_stopped_processes();
+
+	int32_t child_pid = get_open_pid();
+	if (child_pid < 0)
+		return -1;
+
 	spin_lock_irqsave(pcb_spin_lock);
 
-	pcb_t *pcb = get_pcb_from_pid(pid);
-	pcb->state = PROCESS_SLEEPING;
+	// Get the PCBs after getting the PID, since that may have moved the pcbs array
+	pcb_t *pcb = get_pcb();
+	pcb_t *child_pcb = &pcbs.data[child_pid];
+
+	uint32_t *page_directory = create_page_directory();
+	void *kernel_stack_base = alloc_kernel_stack() + KERNEL_STACK_SIZE;
+	if (page_directory == NULL || kernel_stack_base == (void*)KERNEL_STACK_SIZE)
+		goto process_fork_fail;
+
+	// Copy the files array and the memory regions (except for private ones)
+	DYN_ARR_INIT(file_t, child_pcb->files);
+	DYN_ARR_INIT(memory_region, child_pcb->memory_regions);
+	if (child_pcb->files.data == NULL || child_pcb->memory_regions.data == NULL ||
+	    DYN_ARR_RESERVE(file_t, child_pcb->files, pcb->files.length) != 0 ||
+	    DYN_ARR_RESERVE(memory_region, child_pcb->memory_regions, pcb->memory_regions.length) != 0) {
+		DYN_ARR_DELETE(child_pcb->files);
+		DYN_ARR_DELETE(child_pcb->memory_regions);
+		goto process_fork_fail;
+	}
+	// These calls cannot fail because room for every element was reserved above
+	int i;
+	for (i = 0; i < pcb->files.length; i++)
+		DYN_ARR_PUSH(file_t, child_pcb->files, pcb->files.data[i]);
+	for (i = 0; i < pcb->memory_regions.length; i++) {
+		memory_region *region = &pcb->memory_regions.data[i];
+		if (region->flags & MEMORY_REGION_PRIVATE)
+			continue;
+
+		DYN_ARR_PUSH(memory_region, child_pcb->memory_regions, *region);
+		// The entry for the executable already exists, so this cannot fail
+		if (region->flags & MEMORY_REGION_SHARED_TEXT)
+			get_resident_executable(region->inode, region->num_pages);
+		// The child is attached to the same shared memory segments
+		if (region->flags & MEMORY_REGION_SHARED_MEMORY)
+			shared_segments.data[find_shared_segment(region->inode)].num_users++;
+	}
 
-	spin_unlock_irqsave(pcb_spin_lock);
+	// Share every page that has been accessed, making it read-only in both processes
+	// Pages of shared memory are left for the child to fault in from the segment, so that writes to
+	//  them are still seen by both processes
+	// Changing the current process' pages flushes them from the TLB once at the end
+	page_transaction transaction, child_transaction;
+	begin_page_transaction(&transaction, pcb->page_directory);
+	begin_page_transaction(&child_transaction, page_directory);
+	int32_t map_failed = 0;
+	for (i = 0; i < child_pcb->memory_regions.length && !map_failed; i++) {
+		memory_region *region = &child_pcb->memory_regions.data[i];
+		uint32_t page;
+		for (page = 0; page < region->num_pages && !(region->flags & MEMORY_REGION_SHARED_MEMORY); page++) {
+			void *page_addr = (void*)(region->virt_addr + page * NORMAL_PAGE_SIZE);
+			uint32_t pte = get_page_table_entry(pcb->page_directory, page_addr);
+			if (!(pte & PAGE_PRESENT))
+				continue;
+
+			int32_t frame = pte / NORMAL_PAGE_SIZE;
+			if (pte & PAGE_READ_WRITE)
+				page_transaction_map_frames(&transaction, frame, page_addr, 1, PAGE_COPY_ON_WRITE | PAGE_USER_LEVEL);
+			if (page_transaction_map_frames(&child_transaction, frame, page_addr, 1,
+					(pte & (PAGE_READ_WRITE | PAGE_COPY_ON_WRITE)) ? PAGE_COPY_ON_WRITE | PAGE_USER_LEVEL : PAGE_USER_LEVEL) != 0) {
+				map_failed = 1;
+				break;
+			}
+			if (!(region->flags & MEMORY_REGION_FILE_MAPPED))
+				share_frame(frame);
+		}
+	}
+	commit_page_transaction(&transaction);
+	commit_page_transaction(&child_transaction);
 
-	// Enable the timer IRQ so that the scheduler can pick is up
-	sti();
+	// Initialize the fields of the PCB
+	child_pcb->tty = pcb->tty;
+	child_pcb->state = PROCESS_RUNNING;
+	child_pcb->parent_pid = pcb->pid;
+	child_pcb->forked = 1;
+	child_pcb->kernel_stack_base = kernel_stack_base;
+	child_pcb->page_directory = page_directory;
+	child_pcb->next_window_addr = WINDOW_VIRT_START;
+	child_pcb->next_mmap_addr = pcb->next_mmap_addr;
+	child_pcb->wait_queue = NULL;
+	child_pcb->next_waiter = -1;
+	child_pcb->base_priority = pcb->base_priority;
+
+	// The child starts with a copy of the FPU registers, if this process has used the FPU (the
+	//  registers are saved first if they are still in the FPU)
+	child_pcb->fpu_state = NULL;
+	if (pcb->fpu_state != NULL) {
+		if (fpu_owner == pcb->pid)
+			fxsave(pcb->fpu_state);
+		child_pcb->fpu_state = kmalloc_aligned(FPU_STATE_SIZE, FPU_STATE_ALIGNMENT);
+		if (child_pcb->fpu_state != NULL)
+			memcpy(child_pcb->fpu_state, pcb->fpu_state, FPU_STATE_SIZE);
+		else
+			map_failed = 1;
+	}
+	set_priority(child_pcb, pcb->base_priority);
+	memcpy(child_pcb->args, pcb->args, TERMINAL_SIZE);
+	for (i = 0; i < NUM_SIGNALS; i++) {
+		child_pcb->signal_handlers[i] = pcb->signal_handlers[i];
+		child_pcb->signal_status[i] = SIGNAL_OPEN;
+	}
 
-	// Spin while the process is in the sleep state 
-	// The scheduler will take us out of this loop
-	int sleeping = 1;
-	while (sleeping) {
-		spin_lock_irqsave(pcb_spin_lock);
-		sleeping = (get_pcb_from_pid(pid)->state == PROCESS_SLEEPING);
+	// Store the PID at the base of the new kernel stack, with a copy of the registers that this process
+	//  called fork with right below it (see get_user_context), but with 0 as the return value
+	*(int32_t*)(kernel_stack_base - sizeof(int32_t)) = child_pid;
+	process_context *child_context = kernel_stack_base - sizeof(int32_t) - sizeof(process_context);
+	*child_context = *(process_context*)(pcb->kernel_stack_base - sizeof(int32_t) - sizeof(process_context));
+	child_context->eax = 0;
+
+	// If some page could not be shared (or the FPU registers could not be copied), the scheduler frees
+	//  the new process along with the frames that were shared before the failure, without ever running it
+	if (map_failed) {
+		child_pcb->state = PROCESS_STOPPING;
+		queue_push(&stopped_processes, child_pid);
 		spin_unlock_irqsave(pcb_spin_lock);
+		return -1;
 	}
 
-	// Return when the scheduler returns back to this process and it is awake
-	return 0;
+	// The scheduler switches to the new process by loading its ESP and jumping to its EIP, which
+	//  pops the copied registers and returns to userspace
+	child_pcb->context.esp = (uint32_t)child_context;
+	child_pcb->context.ebp = 0;
+	child_pcb->context.eip = (uint32_t)fork_child_linkage;
+	queue_push(&run_queues[child_pcb->priority], child_pid);
+
+	spin_unlock_irqsave(pcb_spin_lock);
+	return child_pid;
+
+process_fork_fail:
+	free_page_directory(page_directory);
+	if (kernel_stack_base != (void*)KERNEL_STACK_SIZE)
+		free_kernel_stack(kernel_stack_base - KERNEL_STACK_SIZE);
+	child_pcb->pid = -1;
+
+	spin_unlock_irqsave(pcb_spin_lock);
+	return -1;
 }
 
 /*
- * Wakes up the process of provided PID
- * 
- * INPUTS: pid: the PID of the process to put to sleep
- * OUTPUTS: 0 on success, and -1 on failure
+ * Creates a kernel thread, which the scheduler runs like any other process, but which runs the given
+ *  function in the kernel with no address space of its own (it uses the kernel's page directory)
+ *  and is not part of any TTY
+ * The function must never return, so it should sleep in a wait queue whenever it has nothing to do
+ *
+ * INPUTS: fn: the function that the thread runs, which is given data as its argument
+ * OUTPUTS: the PID of the thread, or -1 on failure
  */
-int32_t process_wake(int32_t pid) {
+int32_t kthread_create(void (*fn)(void *data), void *data) {
+	int32_t pid = get_open_pid();
+	if (pid < 0)
+		return -1;
+
 	spin_lock_irqsave(pcb_spin_lock);
 
-	pcb_t *pcb = get_pcb_from_pid(pid);
+	pcb_t *pcb = &pcbs.data[pid];
+	void *kernel_stack_base = alloc_kernel_stack() + KERNEL_STACK_SIZE;
+	if (kernel_stack_base == (void*)KERNEL_STACK_SIZE) {
+		pcb->pid = -1;
+		spin_unlock_irqsave(pcb_spin_lock);
+		return -1;
+	}
 
-	// Check that the process is sleeping, it should not be woken if stopping
-	if (pcb->state != PROCESS_SLEEPING) {
+	// The thread has no files or memory regions, but free_pid and the system calls expect the arrays
+	DYN_ARR_INIT(file_t, pcb->files);
+	DYN_ARR_INIT(memory_region, pcb->memory_regions);
+	if (pcb->files.data == NULL || pcb->memory_regions.data == NULL) {
+		DYN_ARR_DELETE(pcb->files);
+		DYN_ARR_DELETE(pcb->memory_regions);
+		free_kernel_stack(kernel_stack_base - KERNEL_STACK_SIZE);
+		pcb->pid = -1;
 		spin_unlock_irqsave(pcb_spin_lock);
 		return -1;
 	}
 
+	// Initialize the fields of the PCB (TTY 0 keeps the thread out of every TTY, such as when
+	//  the keyboard sends signals to the processes in the active one)
+	int i;
+	pcb->tty = 0;
 	pcb->state = PROCESS_RUNNING;
+	pcb->parent_pid = -1;
+	pcb->forked = 1;
+	pcb->kernel_stack_base = kernel_stack_base;
+	pcb->page_directory = kernel_page_directory;
+	pcb->next_window_addr = WINDOW_VIRT_START;
+	pcb->next_mmap_addr = MMAP_VIRT_START;
+	pcb->wait_queue = NULL;
+	pcb->next_waiter = -1;
+	pcb->fpu_state = NULL;
+	pcb->base_priority = DEFAULT_PRIORITY;
+	set_priority(pcb, pcb->base_priority);
+	pcb->args[0] = '\0';
+	for (i = 0; i < NUM_SIGNALS; i++) {
+		pcb->signal_handlers[i] = NULL;
+		pcb->signal_status[i] = SIGNAL_OPEN;
+	}
+
+	// Store the PID at the base of the kernel stack, with the argument and a return address for the
+	//  function below it, so that the scheduler calls the function by loading its ESP and jumping to it
+	uint32_t *stack = kernel_stack_base - sizeof(int32_t);
+	*stack = pid;
+	*(--stack) = (uint32_t)data;
+	*(--stack) = 0;
+	pcb->context.esp = (uint32_t)stack;
+	pcb->context.ebp = 0;
+	pcb->context.eip = (uint32_t)fn;
+	queue_push(&run_queues[pcb->priority], pid);
 
 	spin_unlock_irqsave(pcb_spin_lock);
+	return pid;
+}
+
+/*
+ * Places a memory region in the part of the address space used by mmap and shared memory, after the
+ *  regions placed there before, and adds it to the memory regions of the process
+ * The PCB must be locked by the caller
+ *
+ * INPUTS: pcb: the process to add the region to
+ *         region: the region to add, whose virt_addr is filled in
+ * OUTPUTS: the address that the region was placed at, or NULL if it does not fit
+ */
+static void* add_mmap_region(pcb_t *pcb, memory_region *region) {
+	if (region->num_pages > (MMAP_VIRT_END - pcb->next_mmap_addr) / NORMAL_PAGE_SIZE)
+		return NULL;
+
+	region->virt_addr = pcb->next_mmap_addr;
+	if (DYN_ARR_PUSH(memory_region, pcb->memory_regions, *region) < 0)
+		return NULL;
+	pcb->next_mmap_addr += region->num_pages * NORMAL_PAGE_SIZE;
+
+	return (void*)region->virt_addr;
+}
+
+/*
+ * Maps a file read-only into the memory of the current process, after any files it has mapped before
+ * Nothing is read until the pages are accessed (see process_page_fault); if the file system image is
+ *  page aligned, each page is then mapped straight to the block of the image that holds it, so that
+ *  the file is never copied, and otherwise each page is given a private copy of its block
+ * The file stays mapped until the process halts
+ *
+ * INPUTS: inode: the inode of the file
+ * OUTPUTS: the address that the file was mapped to, or NULL if it is empty or does not fit
+ */
+void* process_mmap(uint32_t inode) {
+	int32_t size = fs_inode_size(inode);
+	if (size <= 0)
+		return NULL;
+
+	spin_lock_irqsave(pcb_spin_lock);
+
+	memory_region region;
+	region.num_pages = (size + NORMAL_PAGE_SIZE - 1) / NORMAL_PAGE_SIZE;
+	region.inode = inode;
+	region.file_offset = 0;
+	region.file_size = size;
+	region.flags = MEMORY_REGION_READ_ONLY;
+	if (fs_data_block_frame(inode, 0) != -1)
+		region.flags |= MEMORY_REGION_FILE_MAPPED;
+
+	void *addr = add_mmap_region(get_pcb(), &region);
+
+	spin_unlock_irqsave(pcb_spin_lock);
+	return addr;
+}
+
+/*
+ * Creates a shared memory segment and attaches the current process to it, like process_shm_attach
+ * The segment is zero-filled, and its pages are only given frames when they are first accessed
+ *
+ * INPUTS: key: the key that other processes will attach to the segment by, which must not be in use
+ *         size: the size of the segment in bytes, which is rounded up to a whole number of pages
+ * OUTPUTS: the address that the segment was attached at, or NULL if the key is in use or it does not fit
+ */
+void* process_shm_create(int32_t key, uint32_t size) {
+	if (size == 0 || size > MMAP_VIRT_END - MMAP_VIRT_START)
+		return NULL;
+
+	spin_lock_irqsave(pcb_spin_lock);
 
+	memory_region region;
+	region.num_pages = (size + NORMAL_PAGE_SIZE - 1) / NORMAL_PAGE_SIZE;
+	region.inode = key;
+	region.file_offset = 0;
+	region.file_size = 0;
+	region.flags = MEMORY_REGION_SHARED_MEMORY;
+
+	if (find_shared_segment(key) != -1 || create_shared_segment(key, region.num_pages) != 0) {
+		spin_unlock_irqsave(pcb_spin_lock);
+		return NULL;
+	}
+
+	void *addr = add_mmap_region(get_pcb(), &region);
+	if (addr == NULL)
+		put_shared_segment(key);
+
+	spin_unlock_irqsave(pcb_spin_lock);
+	return addr;
+}
+
+/*
+ * Attaches the current process to a shared memory segment, after any files it has mapped and segments
+ *  it has attached to before, so that the frames of the segment are mapped writable into its memory
+ *  as well as that of every other process attached to it
+ *
+ * INPUTS: key: the key of the segment
+ * OUTPUTS: size: stores the size of the segment in bytes
+ *          returns the address that the segment was attached at, or NULL if there is no segment with
+ *           that key or it does not fit
+ */
+void* process_shm_attach(int32_t key, uint32_t *size) {
+	spin_lock_irqsave(pcb_spin_lock);
+
+	int32_t index = find_shared_segment(key);
+	if (index == -1) {
+		spin_unlock_irqsave(pcb_spin_lock);
+		return NULL;
+	}
+
+	memory_region region;
+	region.num_pages = shared_segments.data[index].num_pages;
+	region.inode = key;
+	region.file_offset = 0;
+	region.file_size = 0;
+	region.flags = MEMORY_REGION_SHARED_MEMORY;
+
+	void *addr = add_mmap_region(get_pcb(), &region);
+	if (addr != NULL) {
+		shared_segments.data[index].num_users++;
+		*size = region.num_pages * NORMAL_PAGE_SIZE;
+	}
+
+	spin_unlock_irqsave(pcb_spin_lock);
+	return addr;
+}
+
+/*
+ * Detaches the current process from a shared memory segment, unmapping it from its memory
+ * The segment is freed once no process is attached to it anymore
+ * The addresses that the segment took up are not reused by later calls to mmap or process_shm_attach
+ *
+ * INPUTS: addr: the address that the segment was attached at
+ * OUTPUTS: 0 on success, and -1 if no segment is attached at that address
+ */
+int32_t process_shm_detach(void *addr) {
+	spin_lock_irqsave(pcb_spin_lock);
+
+	pcb_t *pcb = get_pcb();
+	memory_region *region = NULL;
+	int32_t index;
+	for (index = 0; index < pcb->memory_regions.length; index++) {
+		if (pcb->memory_regions.data[index].virt_addr == (uint32_t)addr &&
+		    (pcb->memory_regions.data[index].flags & MEMORY_REGION_SHARED_MEMORY)) {
+			region = &pcb->memory_regions.data[index];
+			break;
+		}
+	}
+
+	if (region == NULL) {
+		spin_unlock_irqsave(pcb_spin_lock);
+		return -1;
+	}
+
+	// The segment still holds a reference to each frame, so none of them are freed before the
+	//  pages are unmapped and flushed from the TLB
+	page_transaction transaction;
+	begin_page_transaction(&transaction, pcb->page_directory);
+	uint32_t page;
+	for (page = 0; page < region->num_pages; page++) {
+		void *page_addr = (void*)(region->virt_addr + page * NORMAL_PAGE_SIZE);
+		int32_t frame = get_mapped_frame(pcb->page_directory, page_addr);
+		if (frame != -1)
+			release_frame(frame);
+	}
+	page_transaction_unmap_frames(&transaction, addr, region->num_pages);
+	commit_page_transaction(&transaction);
+
+	int32_t key = region->inode;
+	DYN_ARR_REMOVE(memory_region, pcb->memory_regions, index);
+	put_shared_segment(key);
+
+	spin_unlock_irqsave(pcb_spin_lock);
 	return 0;
 }
 
+/*
+ * Changes the base priority of the current process, like nice in Unix: a positive increment makes
+ *  the process run after others (such as for a batch job), and a negative one makes it run before them
+ * The process is moved down to its new base priority right away if it is above it
+ *
+ * INPUTS: increment: the number of levels to lower the base priority by
+ * OUTPUTS: the new base priority, from 0 (the highest) to NUM_PRIORITY_LEVELS - 1
+ */
+int32_t process_nice(int32_t increment) {
+	spin_lock_irqsave(pcb_spin_lock);
+
+	pcb_t *pcb = get_pcb();
+	int32_t base_priority = pcb->base_priority + increment;
+	if (base_priority < 0)
+		base_priority = 0;
+	if (base_priority >= NUM_PRIORITY_LEVELS)
+		base_priority = NUM_PRIORITY_LEVELS - 1;
+
+	pcb->base_priority = base_priority;
+	if (pcb->priority < base_priority)
+		set_priority(pcb, base_priority);
+
+	spin_unlock_irqsave(pcb_spin_lock);
+	return base_priority;
+}
+
+/*
+ * Puts the current process to sleep at the end of the given wait queue, and runs other processes
+ *  (or idles) until it is woken up with wake_up, rather than spinning for the rest of its quantum
+ * To avoid missing a wake up, interrupts should be disabled from checking whether the process needs
+ *  to sleep until this is called; they are enabled again once the process is running
+ *
+ * INPUTS: queue: the wait queue to sleep in
+ */
+void process_wait(wait_queue_t *queue) {
+	spin_lock_irqsave(pcb_spin_lock);
+
+	pcb_t *pcb = get_pcb();
+	pcb->state = PROCESS_SLEEPING;
+	queue_push(queue, pcb->pid);
+
+	spin_unlock_irqsave(pcb_spin_lock);
+
+	// The scheduler skips the process while it sleeps, so switch away right away
+	while (get_pcb()->state == PROCESS_SLEEPING)
+		schedule();
+}
+
+/*
+ * Wakes up the process that has been waiting the longest in the given wait queue, moving it to the
+ *  run queue so that the scheduler will run it again
+ * A process that blocks on input is most likely interactive, so it goes back to its base priority
+ *
+ * INPUTS: queue: the wait queue to wake a process up from
+ * OUTPUTS: the PID of the process that was woken up, or -1 if no process was waiting
+ */
+int32_t wake_up(wait_queue_t *queue) {
+	spin_lock_irqsave(pcb_spin_lock);
+
+	int32_t pid = queue_pop(queue);
+	if (pid != -1) {
+		set_priority(&pcbs.data[pid], pcbs.data[pid].base_priority);
+		make_runnable(pid);
+
+		if (pid != get_pid() && pcbs.data[pid].priority < get_pcb()->priority)
+			need_reschedule = 1;
+	}
+
+	spin_unlock_irqsave(pcb_spin_lock);
+	return pid;
+}
+
 /*
  * Switches from the current TTY to the provided TTY
  * Must be called from the kernel stack of a userspace program
@@ -802,6 +1913,44 @@ int32_t tty_switch(uint8_t tty) {
 	return 0;
 }
 
+/*
+ * Gives the FPU to the current process, which is called when it uses the FPU while CR0.TS is set
+ * The registers of the process that used the FPU last are saved to its PCB, and the registers of the
+ *  current process are loaded in their place, so that processes which never use the FPU never pay
+ *  for saving and restoring it; the first time a process uses the FPU, it gets the initial registers
+ *
+ * OUTPUTS: 0 if the process can use the FPU and -1 if there is no memory for its registers
+ */
+int32_t process_fpu_fault() {
+	uint32_t flags;
+	cli_and_save(flags);
+
+	pcb_t *pcb = get_pcb();
+	clear_task_switched();
+	if (fpu_owner == pcb->pid) {
+		restore_flags(flags);
+		return 0;
+	}
+
+	if (pcb->fpu_state == NULL) {
+		pcb->fpu_state = kmalloc_aligned(FPU_STATE_SIZE, FPU_STATE_ALIGNMENT);
+		if (pcb->fpu_state == NULL) {
+			set_task_switched();
+			restore_flags(flags);
+			return -1;
+		}
+		memcpy(pcb->fpu_state, initial_fpu_state, FPU_STATE_SIZE);
+	}
+
+	if (fpu_owner != -1)
+		fxsave(get_pcb_from_pid(fpu_owner)->fpu_state);
+	fxrstor(pcb->fpu_state);
+	fpu_owner = pcb->pid;
+
+	restore_flags(flags);
+	return 0;
+}
+
 /*
  * Switches from the currently running userspace program to the program with the given PID
  * Must be called from the kernel stack of a userspace program
@@ -828,15 +1977,21 @@ int32_t context_switch(int32_t pid) {
 	pcb_t *old_pcb = get_pcb();
 	pcb_t *new_pcb = get_pcb_from_pid(pid);
 
-	// Unmap the memory for the previous process and map in the memory for the new one
-	// This should handle mapping in video memory as well
-	unmap_process(old_pcb->pid);
-	map_process(new_pcb->pid);
+	// Switch to the memory of the new process, which only needs a write to CR3 since the kernel's
+	//  mappings are global and identical in every page directory
+	load_page_directory(new_pcb->page_directory);
 
 	// Set the TSS ESP0 and SS0 entries for the new process
 	tss.esp0 = (uint32_t)new_pcb->kernel_stack_base - sizeof(uint32_t);
 	tss.ss0 = KERNEL_DS;
 
+	// The FPU registers are left where they are, and only the process that they belong to can use the
+	//  FPU without faulting
+	if (old_pcb->pid == fpu_owner)
+		set_task_switched();
+	else if (new_pcb->pid == fpu_owner)
+		clear_task_switched();
+
 	// Get the address that we will return to when we come back to this process
 	//  && is a GCC-specific operator that gets the address of a label
 	old_pcb->context.eip = (uint32_t)(&&context_switch_return);
@@ -868,44 +2023,164 @@ context_switch_return:
 }
 
 /*
- * Handler called by timer that switches to the next process in a round robin fashion
+ * Gets the number of ticks that the given process can run for before the scheduler has to run again
+ *
+ * INPUTS: pcb: the process that is about to run
+ * OUTPUTS: the ticks left in its quantum, or 0 if it can run for as long as it likes because it is
+ *          idling or no other process is waiting to run
  */
-void scheduler_interrupt_handler() {
+static uint32_t scheduler_deadline(pcb_t *pcb) {
+	int32_t level;
+	if (pcb->state != PROCESS_RUNNING)
+		return 0;
+
+	for (level = 0; level < NUM_PRIORITY_LEVELS; level++) {
+		if (run_queues[level].head != -1)
+			return (pcb->ticks_left > 0) ? pcb->ticks_left : 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Handler called by timer that picks the next process using a multilevel feedback queue
+ * A process runs until it has used up its quantum, and then it moves down a priority level and goes
+ *  to the back of the run queue for that level, behind any other processes at that level that are
+ *  waiting for their turn; it is switched away from early if a process of higher priority can run
+ * This takes the same time no matter how many processes there are
+ * The next timer interrupt is set for the end of the quantum of the process that runs next, and not
+ *  at all if no other process is waiting for it to finish
+ *
+ * INPUTS: ticks: the number of timer ticks that passed since this was last called
+ */
+void scheduler_interrupt_handler(uint32_t ticks) {
 	// We don't want the scheduler to be interrupted by anything, it should be fast
 	cli();
 
 	// If there are no running processes, exit
-	if (pcbs.length == 0)
+	if (pcbs.length == 0) {
+		set_next_timer_interrupt(0);
 		return;
+	}
 
-	// Get the current PCB and the current PID, we will just go to the next PID
+	// Any process that was woken up is considered here
+	need_reschedule = 0;
+
+	// Only processes of higher priority can take over from a process that still has time left
+	// A process that is idling in schedule, because it is asleep or stopping, makes way for any process
 	pcb_t *pcb = get_pcb();
-	int pid = pcb->pid;
-
-	// Iterate through the pcbs array until we find an existing process that is in 
-	//  the state PROCESS_RUNNING, which means we can switch to it
-	// Stop looping when we run into the current process
-	int i, next_pid;
-	next_pid = -1;
-	for (i = (pid + 1) % pcbs.length; i != pid; i = (i + 1) % pcbs.length) {
-		if (pcbs.data[i].pid >= 0 && pcbs.data[i].state == PROCESS_RUNNING) {
-			// Set this as the next process
-			next_pid = i;
-			break;
-		}
+	int32_t lowest_level = NUM_PRIORITY_LEVELS - 1;
+	if (pcb->state == PROCESS_RUNNING) {
+		pcb->ticks_left = (pcb->ticks_left > ticks) ? pcb->ticks_left - ticks : 0;
 
-		// If we find a process that needs to be stopped, let's just clear it out
-		if (pcbs.data[i].pid >= 0 && pcbs.data[i].pid != pid && pcbs.data[i].state == PROCESS_STOPPING) {
-			free_pid(i);
+		if (pcb->ticks_left == 0) {
+			set_priority(pcb, (pcb->priority < NUM_PRIORITY_LEVELS - 1) ? pcb->priority + 1 : pcb->priority);
+			lowest_level = pcb->priority;
+		} else {
+			lowest_level = pcb->priority - 1;
 		}
 	}
 
-	// If we found no process to switch to, just keep going with this process
+	// If no such process can run, just keep going with this process (which may be idling in
+	//  schedule, in which case it goes back to waiting for an interrupt)
+	int32_t next_pid = pop_runnable(lowest_level);
 	if (next_pid == -1) {
+		set_next_timer_interrupt(scheduler_deadline(pcb));
 		sti();
 		return;
 	}
 
+	// The current process takes its turn again later, unless it is idling
+	if (pcb->state == PROCESS_RUNNING)
+		queue_push(&run_queues[pcb->priority], pcb->pid);
+
 	// Otherwise, context switch to that process
+	set_next_timer_interrupt(scheduler_deadline(get_pcb_from_pid(next_pid)));
+	context_switch(next_pid);
+}
+
+/*
+ * Called on the way out of every interrupt, which switches right away to a process that the interrupt
+ *  woke up if it has a higher priority than the current process, rather than leaving it to wait for
+ *  the next timer interrupt; the current process goes to the back of its run queue with the rest of
+ *  its quantum
+ * A process that is idling in schedule is left alone, since it switches as soon as the interrupt returns
+ */
+void preempt_on_wakeup() {
+	uint32_t flags;
+
+	if (!need_reschedule)
+		return;
+
+	cli_and_save(flags);
+	need_reschedule = 0;
+
+	pcb_t *pcb = get_pcb();
+	int32_t next_pid = (pcb->state == PROCESS_RUNNING) ? pop_runnable(pcb->priority - 1) : -1;
+	if (next_pid == -1) {
+		restore_flags(flags);
+		return;
+	}
+
+	queue_push(&run_queues[pcb->priority], pcb->pid);
+	context_switch(next_pid);
+	restore_flags(flags);
+}
+
+/*
+ * Switches to the next process that can run, which is called by a process that is going to sleep or
+ *  halting so that it does not use up the rest of its quantum
+ * If no process can run, not even the current one, this idles: halted processes are freed, and then
+ *  the processor is halted until an interrupt wakes a process up, so that an idle system does not
+ *  keep the CPU busy
+ * The idle loop runs on the kernel stack of the current process, since interrupt handlers expect
+ *  get_pcb to return some process; the timer may still switch away from it as usual
+ */
+void schedule() {
+	cli();
+
+	if (pcbs.length == 0) {
+		sti();
+		return;
+	}
+
+	// If the current process was woken up in the meantime, it keeps running unless a process of
+	//  higher priority is waiting
+	int32_t next_pid;
+	need_reschedule = 0;
+	while (1) {
+		pcb_t *pcb = get_pcb();
+		next_pid = pop_runnable((pcb->state == PROCESS_RUNNING) ? pcb->priority - 1 : NUM_PRIORITY_LEVELS - 1);
+		if (next_pid != -1 || pcb->state == PROCESS_RUNNING)
+			break;
+
+		reap_stopped_processes();
+
+		// Nothing else is running, so use the time to zero frames ahead of time (unless this process
+		//  is stopping, since it would never finish the frame if it were switched away from and freed)
+		if (get_pcb()->state == PROCESS_SLEEPING) {
+			sti();
+			int32_t refilled = refill_zeroed_frames();
+			cli();
+			if (refilled)
+				continue;
+		}
+
+		// Enable interrupts and halt in one step, so that an interrupt cannot arrive in between,
+		//  then check again after the interrupt has been handled
+		asm volatile ("sti; hlt; cli");
+	}
+
+	// The current process was woken up and no process of higher priority is waiting to run
+	if (next_pid == -1) {
+		sti();
+		return;
+	}
+
+	// The current process only goes back into the run queue if it was woken up in the meantime
+	pcb_t *pcb = get_pcb();
+	if (pcb->state == PROCESS_RUNNING)
+		queue_push(&run_queues[pcb->priority], pcb->pid);
+
 	context_switch(next_pid);
 }
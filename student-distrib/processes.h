@@ -22,6 +22,9 @@
 #define NUM_TEXT_TTYS 3
 // The total number of TTYs
 #define NUM_TTYS 4
+// The number of PCBs that the pcbs array always has room for, so that starting and halting
+//  processes does not keep resizing it
+#define NUM_RESERVED_PCBS 16
 
 // Magic number that must appear in the first 4 bytes of all executables
 #define ELF_MAGIC 0x464C457F
@@ -31,6 +34,25 @@
 #define EXECUTABLE_PAGE_OFFSET 0x48000
 // The offset in the executable where the entrypoint of the program is stored
 #define ENTRYPOINT_OFFSET 24
+// The type of ELF program header that describes a segment loaded into memory
+#define ELF_PT_LOAD 1
+// Set in the flags of an ELF program header whose segment is writable
+#define ELF_PF_W 0x2
+// The size of the stack of a userspace program, which ends at the end of the 4MB region that
+//  the program is loaded into
+#define USER_STACK_SIZE 0x10000
+#define USER_STACK_TOP (EXECUTABLE_VIRT_PAGE_START + LARGE_PAGE_SIZE)
+// The largest executable image that fits between where it is loaded and the bottom of the stack
+#define MAX_IMAGE_SIZE (USER_STACK_TOP - USER_STACK_SIZE - EXECUTABLE_VIRT_PAGE_START - EXECUTABLE_PAGE_OFFSET)
+// The virtual addresses that the files mapped by a process with mmap and the shared memory segments
+//  it attaches to are placed at, one after another (from the end of the stack at 132MB up to where
+//  video memory is mapped at 192MB)
+#define MMAP_VIRT_START USER_STACK_TOP
+#define MMAP_VIRT_END VIDEO_USER_VIRT_ADDR
+// The virtual address that the windows of a process are mapped to, one after another (208MB)
+#define WINDOW_VIRT_START 0xD000000
+// The end of the region that windows are mapped to (the kernel's mapping of physical memory starts here)
+#define WINDOW_VIRT_END PHYS_MAP_ADDR
 
 // Bitmask for ESP that will yield the top of the kernel stack
 #define KERNEL_STACK_BASE_BITMASK 0xFFFFE000
@@ -68,27 +90,100 @@ typedef struct file_t {
 // A dynamic array containing file_t elements
 typedef DYNAMIC_ARRAY(file_t, file_dyn_arr) file_dyn_arr;
 
-// Represents a page mapping
-typedef struct page_mapping {
-	// The index of the virtual address of the page (corresponding to 4MB jumps per index)
-	int virt_index;
-	// The index of the physical address of the page (corresponding to 4MB jumps per index)
-	int phys_index;
-} page_mapping;
+// The ELF file header at the start of every executable
+typedef struct elf_header {
+	uint8_t  ident[16];
+	uint16_t type;
+	uint16_t machine;
+	uint32_t version;
+	uint32_t entry;
+	uint32_t phoff;
+	uint32_t shoff;
+	uint32_t flags;
+	uint16_t ehsize;
+	uint16_t phentsize;
+	uint16_t phnum;
+	uint16_t shentsize;
+	uint16_t shnum;
+	uint16_t shstrndx;
+} __attribute__((packed)) elf_header;
 
-// A dynamic array of ints where each item represents an index of a 4MB page used by a process
-typedef DYNAMIC_ARRAY(page_mapping, page_mapping_dyn_arr) page_mapping_dyn_arr;
+// An ELF program header, which describes a segment of the program
+typedef struct elf_program_header {
+	uint32_t type;
+	uint32_t offset;
+	uint32_t vaddr;
+	uint32_t paddr;
+	uint32_t filesz;
+	uint32_t memsz;
+	uint32_t flags;
+	uint32_t align;
+} __attribute__((packed)) elf_program_header;
+
+// Represents a region of consecutive 4KB pages that a process may use
+// Pages are given frames the first time they are accessed, which are filled from a file if the
+//  region is backed by one, and zeroed otherwise
+typedef struct memory_region {
+	// The virtual address of the first page
+	uint32_t virt_addr;
+	// The number of pages
+	uint32_t num_pages;
+	// The inode of the file that the region is backed by, or -1 if it is zero-filled
+	// For shared memory, this is instead the key of the segment that the region is attached to
+	int32_t inode;
+	// The offset in the file that the first page is filled from
+	uint32_t file_offset;
+	// The number of bytes from the start of the region that come from the file, after which it is zero-filled
+	uint32_t file_size;
+	// Options for the region (MEMORY_REGION_*)
+	uint32_t flags;
+} memory_region;
+
+// Set in the flags of a memory region that is not inherited by children created with fork, such as
+//  windows, whose frames are drawn by the kernel and so cannot be copied on write
+#define MEMORY_REGION_PRIVATE 0x1
+// Set in the flags of the read-only part of an executable, whose frames are shared by every process
+//  running the same executable rather than filled in separately for each of them
+#define MEMORY_REGION_SHARED_TEXT 0x2
+// Set in the flags of a region whose pages are mapped without write access
+#define MEMORY_REGION_READ_ONLY 0x4
+// Set in the flags of a file mapped with mmap whose pages are mapped straight to the blocks of the
+//  file system image that hold them, so their frames do not belong to the process
+#define MEMORY_REGION_FILE_MAPPED 0x8
+// Set in the flags of a region attached to a shared memory segment, whose frames belong to the
+//  segment and are mapped writable into every process attached to it
+#define MEMORY_REGION_SHARED_MEMORY 0x10
+
+// A dynamic array of the memory regions of a process
+typedef DYNAMIC_ARRAY(memory_region, memory_region_dyn_arr) memory_region_dyn_arr;
 
 // States that a process can take on
-// In this state, the process is running normally and will get scheduled
+// In this state, the process is running normally and will get scheduled (it is either the current
+//  process or in the run queue)
 #define PROCESS_RUNNING  0
 // In this state, the process is blocking on some system call, and will be scheduled when its state
 //  is switched back to RUNNING
 #define PROCESS_SLEEPING 1
-// In this state, the process is marked for deletion, and when its turn comes in the scheduler,
-//  all its resources will be deleted and it will not run
+// In this state, the process is marked for deletion, and it will not run again; its resources are
+//  deleted once no kernel stack in use is its own (the next time a process starts or the CPU idles)
 #define PROCESS_STOPPING 2
 
+// The number of priority levels that the scheduler keeps a run queue for, where 0 is the highest
+// Processes that use up their quantum move down a level, and they move back up to their base priority
+//  when they wake up from a blocking call, so that interactive programs stay ahead of busy ones
+#define NUM_PRIORITY_LEVELS 4
+// The base priority of a process that is not started by another process
+#define DEFAULT_PRIORITY 0
+// The number of timer ticks that a process at the given priority level runs for before it is moved
+//  down a level, which is longer for lower levels so that busy processes switch less often
+#define PRIORITY_QUANTUM(level) (1 << (level))
+
+// The size of the area that FXSAVE stores the FPU and SSE registers to, and its required alignment
+#define FPU_STATE_SIZE 512
+#define FPU_STATE_ALIGNMENT 16
+// The value of MXCSR after reset, which masks all SSE exceptions
+#define MXCSR_DEFAULT 0x1F80
+
 // All the registers that a process may be using before being interrupted that should be restored
 struct process_context {
 	uint32_t ebx;
@@ -129,6 +224,19 @@ struct blocking_call_t {
 
 typedef struct blocking_call_t blocking_call_t;
 
+// A queue of processes that are sleeping until something happens, such as input arriving, in the
+//  order that they went to sleep (the scheduler also keeps the processes that can run in one)
+// The processes are linked through their PCBs by PID, since the pcbs array may move when it grows
+typedef struct wait_queue_t {
+	// The PID of the process that has been waiting the longest, or -1 if the queue is empty
+	int32_t head;
+	// The PID of the process that started waiting most recently, or -1 if the queue is empty
+	int32_t tail;
+} wait_queue_t;
+
+// Constant that represents a wait queue with no processes in it
+#define WAIT_QUEUE_EMPTY {-1, -1}
+
 // Values that can be placed in the type field of a blocking_call_t struct
 #define BLOCKING_CALL_NONE          0
 #define BLOCKING_CALL_RTC           1
@@ -139,8 +247,15 @@ typedef struct blocking_call_t blocking_call_t;
 typedef struct pcb_t {
 	// A dynamic array of the files that are being used by the process
 	file_dyn_arr files;
-	// A dynamic array of the indices of the 4MB pages allocated to this process (excluding video memory)
-	page_mapping_dyn_arr large_page_mappings;
+	// A dynamic array of the memory regions of this process (excluding video memory)
+	memory_region_dyn_arr memory_regions;
+	// The page directory of this process, which holds the mappings above as well as the kernel's
+	uint32_t *page_directory;
+	// The virtual address that the next window of this process will be mapped to
+	uint32_t next_window_addr;
+	// The virtual address that the next file mapped or shared memory segment attached by this process
+	//  will be placed at
+	uint32_t next_mmap_addr;
 	// The address of the base of the kernel stack
 	void *kernel_stack_base;
 	// The TTY that this process is in (1-based indices)
@@ -149,12 +264,28 @@ typedef struct pcb_t {
 	int32_t pid;
 	// The PID of the parent process
 	int32_t parent_pid;
+	// 1 if this process was created by fork, in which case the parent is not waiting for it to halt
+	uint8_t forked;
 	// The buffer of arguments
 	int8_t args[TERMINAL_SIZE];
 	// The state of the process (either PROCESS_RUNNING, PROCESS_SLEEPING, or PROCESS_STOPPING)
 	uint8_t state;
+	// The priority level that the process is scheduled at (0 is the highest)
+	uint8_t priority;
+	// The priority level that the process goes back to when it wakes up, which is set by nice
+	uint8_t base_priority;
+	// The number of timer ticks that the process can still run for before it is moved down a level
+	uint8_t ticks_left;
+	// The FPU and SSE registers of the process (FPU_STATE_SIZE bytes, saved by FXSAVE) while another
+	//  process is using the FPU, or NULL if the process has never used the FPU
+	void *fpu_state;
 	// If the state is PROCESS_SLEEPING (due to a blocking call), data associated with the blocking call
 	blocking_call_t blocking_call;
+	// The queue that the process is in, or NULL if it is not in one: either a wait queue that it is
+	//  sleeping in, the run queue if it is waiting to run, or the queue of processes to be freed
+	wait_queue_t *wait_queue;
+	// The PID of the process after this one in its queue, or -1 if it is the last one
+	int32_t next_waiter;
 	// The values of ESP, EIP, and EBP before the scheduler switched to another process
 	// All other registers are stored on the stack by the timer linkage
 	scheduler_context context;
@@ -174,18 +305,37 @@ int init_processes();
 int32_t process_execute(const char *command, uint8_t has_parent, uint8_t tty, uint8_t save_context);
 // Halts the current process and returns the provided status code to the parent process
 int32_t process_halt(uint16_t status);
+// Creates a copy of the current process that shares its memory until either of them writes to it
+int32_t process_fork();
+// Creates a kernel thread that the scheduler runs like a process, which runs the given function in the kernel
+int32_t kthread_create(void (*fn)(void *data), void *data);
+// Maps the file with the given inode read-only into the memory of the current process
+void* process_mmap(uint32_t inode);
+// Creates a shared memory segment with the given key and attaches the current process to it
+void* process_shm_create(int32_t key, uint32_t size);
+// Attaches the current process to the shared memory segment with the given key
+void* process_shm_attach(int32_t key, uint32_t *size);
+// Detaches the current process from the shared memory segment attached at the given address
+int32_t process_shm_detach(void *addr);
+// Changes the base priority of the current process by the given number of levels
+int32_t process_nice(int32_t increment);
 // Maps video memory for the current userspace program to either video memory or a buffer depending
 //  on whether or not the current program is in the active TTY
 int32_t process_vidmap(uint8_t **screen_start);
-// Marks the provided process as asleep and spins until the current quantum is complete,
-//  in the case that the current quantum is the process being put to sleep
-int32_t process_sleep(int32_t pid);
-int32_t unmap_process(int32_t pid);
-int32_t map_process(int32_t pid);
-// Wakes up the process of provided PID
-int32_t process_wake(int32_t pid);
+// Puts the current process to sleep in the given wait queue, running other processes until it is woken up
+void process_wait(wait_queue_t *queue);
+// Wakes up the process that has been waiting the longest in the given wait queue
+int32_t wake_up(wait_queue_t *queue);
+// Gives a frame to the page of the current process that was accessed, if the page is part of one of its
+//  memory regions and has not been accessed before
+int32_t process_page_fault(void *addr);
+// Gives the FPU to the current process after it has tried to use it, saving the registers of the
+//  process that used it last
+int32_t process_fpu_fault();
 // Checks if the given region lies within the memory assigned to the process with the given PID
 int8_t is_userspace_region_valid(void *ptr, uint32_t size, int32_t pid);
+// Checks if the given region lies within memory of the process with the given PID that it can write to
+int8_t is_userspace_region_writable(void *ptr, uint32_t size, int32_t pid);
 // Checks if the given string lies within the memory assigned to the process with the given PID
 int8_t is_userspace_string_valid(void *ptr, int32_t pid);
 // Gets the current PID from tss.esp0
@@ -199,7 +349,11 @@ void *get_vid_mem(uint8_t tty);
 // Switches from the current TTY to the provided TTY
 int32_t tty_switch(uint8_t tty);
 // The handler called by the timer that switches to the next process 
-void scheduler_interrupt_handler();
+void scheduler_interrupt_handler(uint32_t ticks);
+// Gives up the rest of the current process' quantum, idling if no process can run
+void schedule();
+// Switches to a process woken up by an interrupt if it has a higher priority than the current one
+void preempt_on_wakeup();
 
 // The currently active TTY
 extern uint8_t active_tty;
@@ -13,8 +13,8 @@ typedef struct rtc_client {
 	// The number of RTC ticks that must pass for this process to finish its read
 	// Set by rtc_write
 	int interval;
-	// Whether or not the client is waiting to be woken up
-	int waiting;
+	// The process while it is waiting in rtc_read for the interval to pass
+	wait_queue_t waiting;
 } rtc_client;
 
 // We will keep the metadata in a linked list
@@ -152,12 +152,9 @@ void rtc_handler() {
 	// Go through the list of all RTC clients and wake up those that should be triggered
 	rtc_client_list_item *cur;
 	for (cur = rtc_client_list_head; cur != NULL; cur = cur->next) {
-		// Check if the correct interval has passed and if the process was waiting
-		if (cur->data.waiting && counter % cur->data.interval == 0) {
-			// If so, wake up the process
-			cur->data.waiting = 0;
-			process_wake(cur->data.pid);
-		}
+		// Check if the correct interval has passed, and if so, wake up the process if it was waiting
+		if (counter % cur->data.interval == 0)
+			wake_up(&cur->data.waiting);
 	}
 
 	// Set that we are back in userspace
@@ -201,7 +198,7 @@ int32_t rtc_open(const uint8_t *filename) {
 	// Fill in the fields of the linked list node
 	client->data.pid = pid;
 	client->data.interval = BASE_FREQ / DEFAULT_FREQ;
-	client->data.waiting = 0;
+	client->data.waiting = (wait_queue_t)WAIT_QUEUE_EMPTY;
 
 	// Push the linked list node into the linked list
 	client->next = rtc_client_list_head;
@@ -276,14 +273,11 @@ int32_t rtc_read(int32_t fd, void *buf, int32_t bytes) {
 		}
 	}
 
-	// Mark the item as waiting
-	item->data.waiting = 1;
-
 	// Set the blocking call field in the PCB
 	get_pcb()->blocking_call.type = BLOCKING_CALL_RTC;
 
 	// Put the process to sleep and let the RTC handler take care of waking it up
-	process_sleep(pid);
+	process_wait(&item->data.waiting);
 
 	// When the process is woken up, it will return here
 	return 0;
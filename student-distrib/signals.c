@@ -19,7 +19,7 @@ static int signals_inited = 0;
 /*
  * Called by the PIT every ten seconds so that programs can get the alarm signal
  */
-void alarm_callback(double sys_time) {
+void alarm_callback(uint32_t sys_time) {
 	spin_lock_irqsave(pcb_spin_lock);
 
 	int i;
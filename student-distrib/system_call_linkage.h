@@ -12,5 +12,8 @@ extern uint32_t in_userspace;
 /* Linkage for system call handler */
 extern void system_call_linkage();
 
+/* Where a process created by fork starts running, which returns to userspace like a system call */
+extern void fork_child_linkage();
+
 #endif
 #endif
@@ -14,6 +14,12 @@
 static struct fops_t rtc_table = {.open = &rtc_open, .close = &rtc_close, .read = &rtc_read, .write = &rtc_write};
 static struct fops_t file_table = {.open = &file_open, .close = &file_close, .read = &file_read, .write = &file_write};
 static struct fops_t dir_table = {.open = &dir_open, .close = &dir_close, .read = &dir_read, .write = &dir_write};
+static struct fops_t heap_stats_table = {.open = &heap_stats_open, .close = &heap_stats_close,
+                                         .read = &heap_stats_read, .write = &heap_stats_write};
+static struct fops_t heap_trace_table = {.open = &heap_trace_open, .close = &heap_trace_close,
+                                         .read = &heap_trace_read, .write = &heap_trace_write};
+static struct fops_t heap_profile_table = {.open = &heap_profile_open, .close = &heap_profile_close,
+                                           .read = &heap_profile_read, .write = &heap_profile_write};
 
 /*
  * Sets the return value of a system call by setting the new value of EAX after the kernel returns
@@ -66,6 +72,24 @@ void sys_call(uint32_t syscall_number, uint32_t param1, uint32_t param2, uint32_
 		case 12: 
 			syscall_set_retval(update_window((int32_t)param1));
 			break;
+		case 13:
+			syscall_set_retval(fork());
+			break;
+		case 14:
+			syscall_set_retval(mmap((int32_t)param1, (void**)param2));
+			break;
+		case 15:
+			syscall_set_retval(shm_create((int32_t)param1, param2, (void**)param3));
+			break;
+		case 16:
+			syscall_set_retval(shm_attach((int32_t)param1, (void**)param2));
+			break;
+		case 17:
+			syscall_set_retval(shm_detach((void*)param1));
+			break;
+		case 18:
+			syscall_set_retval(nice((int32_t)param1));
+			break;
 		default: 
 			syscall_set_retval(FAIL);
 			break;
@@ -131,8 +155,8 @@ int32_t read(int32_t fd, void *buf, int32_t nbytes) {
 		return FAIL;
 	}
 
-	// Check that the buffer is valid
-	if (is_userspace_region_valid(buf, nbytes, cur_pcb->pid) == -1) {
+	// Check that the buffer is valid (the file's data is written into it)
+	if (is_userspace_region_writable(buf, nbytes, cur_pcb->pid) == -1) {
 		spin_unlock_irqsave(pcb_spin_lock);
 		return FAIL;
 	}
@@ -234,9 +258,16 @@ int32_t open(const uint8_t* filename) {
 	}
 
 	// Otherwise, continue trying to add the file	
-	// Read the dentry corresponding to this file to get the file type
+	// Read the dentry corresponding to this file to get the file type, unless it is one of the
+	//  special files provided by the kernel, which are not in the filesystem
 	dentry_t dentry;
-	if (read_dentry_by_name(filename, &dentry) == FAIL) {
+	if (strncmp((int8_t*)filename, HEAP_STATS_FILENAME, sizeof(HEAP_STATS_FILENAME)) == 0) {
+		dentry.filetype = HEAP_STATS_FILE;
+	} else if (strncmp((int8_t*)filename, HEAP_TRACE_FILENAME, sizeof(HEAP_TRACE_FILENAME)) == 0) {
+		dentry.filetype = HEAP_TRACE_FILE;
+	} else if (strncmp((int8_t*)filename, HEAP_PROFILE_FILENAME, sizeof(HEAP_PROFILE_FILENAME)) == 0) {
+		dentry.filetype = HEAP_PROFILE_FILE;
+	} else if (read_dentry_by_name(filename, &dentry) == FAIL) {
 		spin_unlock_irqsave(pcb_spin_lock);
 		return FAIL;
 	}
@@ -267,6 +298,15 @@ int32_t open(const uint8_t* filename) {
 			cur_pcb->files.data[i].inode = dentry.inode; 
 			cur_pcb->files.data[i].fd_table = &(file_table);
 			break;
+		case HEAP_STATS_FILE:
+			cur_pcb->files.data[i].fd_table = &(heap_stats_table);
+			break;
+		case HEAP_TRACE_FILE:
+			cur_pcb->files.data[i].fd_table = &(heap_trace_table);
+			break;
+		case HEAP_PROFILE_FILE:
+			cur_pcb->files.data[i].fd_table = &(heap_profile_table);
+			break;
 		default:
 			// Remove the file from the list of files
 			DYN_ARR_POP(file_t, cur_pcb->files);
@@ -362,7 +402,7 @@ int32_t getargs(uint8_t* buf, int32_t nbytes) {
 	}
 
 	// Check that the buffer is valid
-	if (is_userspace_region_valid(buf, nbytes, cur_pcb->pid) == -1) {
+	if (is_userspace_region_writable(buf, nbytes, cur_pcb->pid) == -1) {
 		spin_unlock_irqsave(pcb_spin_lock);
 		return FAIL;
 	}
@@ -464,3 +504,126 @@ int32_t update_window(int32_t id) {
 		return FAIL;
 	return PASS;
 }
+
+/*
+ * System call that creates a copy of the current process, sharing its memory until either one writes to it
+ * OUTPUTS: the PID of the new process in the current process, 0 in the new process, and -1 on failure
+ */
+int32_t fork() {
+	SYSCALL_DEBUG("Begin fork system call\n");
+
+	return process_fork();
+}
+
+/*
+ * System call that maps a regular file that is open read-only into the memory of the current process,
+ *  so that it can be read without copying it
+ *
+ * INPUTS: fd: the file descriptor of the file
+ * OUTPUTS: addr: stores the virtual address that the file was mapped to
+ * RETURNS: -1 on failure, and the size of the file in bytes on success
+ */
+int32_t mmap(int32_t fd, void **addr) {
+	SYSCALL_DEBUG("Begin mmap system call\n");
+
+	spin_lock_irqsave(pcb_spin_lock);
+
+	pcb_t *cur_pcb = get_pcb();
+
+	// Only files on disk can be mapped
+	if (fd < 0 || fd >= cur_pcb->files.length || !cur_pcb->files.data[fd].in_use ||
+	    cur_pcb->files.data[fd].fd_table != &file_table) {
+		spin_unlock_irqsave(pcb_spin_lock);
+		return FAIL;
+	}
+	uint32_t inode = cur_pcb->files.data[fd].inode;
+
+	spin_unlock_irqsave(pcb_spin_lock);
+
+	// Check that the address can be stored
+	if (is_userspace_region_writable(addr, sizeof(void*), cur_pcb->pid) == -1)
+		return FAIL;
+
+	void *start = process_mmap(inode);
+	if (start == NULL)
+		return FAIL;
+
+	*addr = start;
+	return fs_inode_size(inode);
+}
+
+/*
+ * System call that creates a segment of shared memory and attaches the current process to it
+ * Other processes attach to it by its key, after which all of them see each other's writes to it
+ *  without the kernel copying anything
+ *
+ * INPUTS: key: the key of the new segment, which must not be used by any other segment
+ *         size: the size of the segment in bytes
+ * OUTPUTS: addr: stores the virtual address that the segment was attached at
+ * RETURNS: -1 on failure, and 0 on success
+ */
+int32_t shm_create(int32_t key, uint32_t size, void **addr) {
+	SYSCALL_DEBUG("Begin shm_create system call\n");
+
+	// Check that the address can be stored
+	if (is_userspace_region_writable(addr, sizeof(void*), get_pid()) == -1)
+		return FAIL;
+
+	void *start = process_shm_create(key, size);
+	if (start == NULL)
+		return FAIL;
+
+	*addr = start;
+	return 0;
+}
+
+/*
+ * System call that attaches the current process to an existing segment of shared memory
+ *
+ * INPUTS: key: the key of the segment
+ * OUTPUTS: addr: stores the virtual address that the segment was attached at
+ * RETURNS: -1 on failure, and the size of the segment in bytes on success
+ */
+int32_t shm_attach(int32_t key, void **addr) {
+	SYSCALL_DEBUG("Begin shm_attach system call\n");
+
+	// Check that the address can be stored
+	if (is_userspace_region_writable(addr, sizeof(void*), get_pid()) == -1)
+		return FAIL;
+
+	uint32_t size;
+	void *start = process_shm_attach(key, &size);
+	if (start == NULL)
+		return FAIL;
+
+	*addr = start;
+	return size;
+}
+
+/*
+ * System call that detaches the current process from a segment of shared memory, which is freed
+ *  once every process attached to it has detached or halted
+ *
+ * INPUTS: addr: the virtual address that the segment was attached at
+ * RETURNS: -1 on failure, and 0 on success
+ */
+int32_t shm_detach(void *addr) {
+	SYSCALL_DEBUG("Begin shm_detach system call\n");
+
+	return process_shm_detach(addr);
+}
+
+/*
+ * System call that changes the base priority of the current process, which is the priority level it
+ *  is scheduled at after waking up from a blocking call (0 is the highest)
+ * A batch job can lower its own priority with a positive increment so that it does not get in the way
+ *  of interactive programs
+ *
+ * INPUTS: increment: the number of levels to lower the base priority by (negative to raise it)
+ * RETURNS: the new base priority
+ */
+int32_t nice(int32_t increment) {
+	SYSCALL_DEBUG("Begin nice system call\n");
+
+	return process_nice(increment);
+}
@@ -27,6 +27,12 @@ int32_t set_handler(int32_t signum, void* handler_address);
 int32_t sigreturn(void);
 int32_t allocate_window(int32_t fd, uint32_t *buf);
 int32_t update_window(int32_t id);
+int32_t fork(void);
+int32_t mmap(int32_t fd, void **addr);
+int32_t shm_create(int32_t key, uint32_t size, void **addr);
+int32_t shm_attach(int32_t key, void **addr);
+int32_t shm_detach(void *addr);
+int32_t nice(int32_t increment);
 
 /* A generic system call interface that the assembly linkage calls */
 void sys_call(uint32_t syscall_number, uint32_t param1, uint32_t param2, uint32_t param3);
@@ -35,5 +41,9 @@ void sys_call(uint32_t syscall_number, uint32_t param1, uint32_t param2, uint32_
 #define RTC_FILE 0
 #define DIRECTORY 1
 #define REG_FILE 2
+// Special files provided by the kernel that do not exist in the filesystem
+#define HEAP_STATS_FILE 3
+#define HEAP_TRACE_FILE 4
+#define HEAP_PROFILE_FILE 5
 
 #endif
@@ -34,19 +34,53 @@ uint32_t* alloc_window(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
     
     pcb_t *pcb = get_pcb();
 
-    int page_index = get_open_page();
-
-    // Add a mapping to the large_page_mappings array
-    page_mapping mapping;
-    mapping.virt_index = page_index;
-    mapping.phys_index = page_index;
-    DYN_ARR_PUSH(page_mapping, pcb->large_page_mappings, mapping);
-
-    // Map in the page for the window
-    if (map_containing_region((void*)(page_index * LARGE_PAGE_SIZE), (void*)(page_index * LARGE_PAGE_SIZE), 1, 
-            PAGE_SIZE_IS_4M | PAGE_USER_LEVEL | PAGE_READ_WRITE | PAGE_PRESENT) == -1) {
+    // Get only as many 4KB frames as the window's pixels take up
+    uint32_t num_frames = (width * height * BYTES_PER_PIXEL + NORMAL_PAGE_SIZE - 1) / NORMAL_PAGE_SIZE;
+    uint32_t *user_buffer = (uint32_t*)pcb->next_window_addr;
+    if (num_frames == 0 || pcb->next_window_addr + num_frames * NORMAL_PAGE_SIZE > WINDOW_VIRT_END) {
+        spin_unlock_irqsave(window_lock);
+        return NULL;
+    }
+    // A window that fits in a single frame gets one that was zeroed ahead of time, while larger windows
+    //  need consecutive frames and are cleared here, so that nothing left in the frames shows through
+    int32_t frame = (num_frames == 1) ? alloc_zeroed_frame() : alloc_contiguous_frames(num_frames);
+    if (frame == -1) {
+        spin_unlock_irqsave(window_lock);
+        return NULL;
+    }
+    if (num_frames > 1)
+        memset(phys_to_virt(frame * NORMAL_PAGE_SIZE), 0, num_frames * NORMAL_PAGE_SIZE);
+
+    // Map in the frames for the window into the process' page directory right away, since the kernel
+    //  draws into them through its own mapping of physical memory
+    page_transaction transaction;
+    begin_page_transaction(&transaction, pcb->page_directory);
+    if (page_transaction_map_frames(&transaction, frame, user_buffer, num_frames, PAGE_USER_LEVEL | PAGE_READ_WRITE) != 0) {
+        page_transaction_unmap_frames(&transaction, user_buffer, num_frames);
+        commit_page_transaction(&transaction);
+        free_contiguous_frames(frame, num_frames);
+        spin_unlock_irqsave(window_lock);
         return NULL;
     }
+    commit_page_transaction(&transaction);
+
+    // Add the window to the process' memory regions, which frees the frames when the process halts
+    memory_region region;
+    region.virt_addr = (uint32_t)user_buffer;
+    region.num_pages = num_frames;
+    region.inode = -1;
+    region.file_offset = 0;
+    region.file_size = 0;
+    region.flags = MEMORY_REGION_PRIVATE;
+    if (DYN_ARR_PUSH(memory_region, pcb->memory_regions, region) < 0) {
+        begin_page_transaction(&transaction, pcb->page_directory);
+        page_transaction_unmap_frames(&transaction, user_buffer, num_frames);
+        commit_page_transaction(&transaction);
+        free_contiguous_frames(frame, num_frames);
+        spin_unlock_irqsave(window_lock);
+        return NULL;
+    }
+    pcb->next_window_addr += num_frames * NORMAL_PAGE_SIZE;
 
     window *new_window = (window*)kmalloc(sizeof(window));
 
@@ -57,21 +91,23 @@ uint32_t* alloc_window(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
     printf("Y: %d\n", new_window->y = y);
     printf("Width: %d\n", new_window->width = width);
     printf("Height: %d\n", new_window->height = height);
-    printf("Buffer location: %x\n", new_window->buffer = (uint32_t*) (page_index * LARGE_PAGE_SIZE));
+    printf("Buffer location: %x\n", new_window->user_buffer = user_buffer);
+    new_window->buffer = phys_to_virt(frame * NORMAL_PAGE_SIZE);
     printf("Process PID: %d\n", new_window->pid = pid);
 
     // int i;
     // for (i = 0; i < 4; i++)
         // new_window->mouse_event[i] = -1;
 
-    new_window->page_index = page_index;
+    new_window->frame = frame;
+    new_window->num_frames = num_frames;
     new_window->need_update = 0;
     insert(new_window);
 
     // Init the window by drawing border on top
     init_window(new_window);
     spin_unlock_irqsave(window_lock);
-    return new_window->buffer;
+    return new_window->user_buffer;
 }
 
 void init_window(window *app) {
@@ -396,16 +432,7 @@ int window_contains_mouse(window *app, uint32_t mouse_x, uint32_t mouse_y) {
 void compositor() {
     spin_lock_irqsave(window_lock);
 
-    // Unmap the memory for the current process
-    unmap_process(get_pid());
-
-    // Map in the memory for all the windows
-    window *cur;
-    for (cur = head; cur != NULL; cur = cur->next) {
-        map_containing_region((void*)(cur->page_index * LARGE_PAGE_SIZE), (void*)(cur->page_index * LARGE_PAGE_SIZE), 1, 
-            PAGE_SIZE_IS_4M | PAGE_USER_LEVEL | PAGE_READ_WRITE | PAGE_PRESENT);
-    }
-
+    // The windows are read through the kernel's mapping of physical memory, so nothing needs to be mapped in
     if (GUI_enabled) {
         memcpy(back_buffer, desktop, svga.width * svga.height *4);
         window *temp = tail;
@@ -418,14 +445,6 @@ void compositor() {
         svga_update(0, 0, svga.width, svga.height);
     }
 
-    // Unmap out the memory for all the windows
-    for (cur = head; cur != NULL; cur = cur->next) {
-        unmap_containing_region((void*)(cur->page_index * LARGE_PAGE_SIZE), 1);
-    }
-
-    // Remap the current process
-    map_process(get_pid());
-
     spin_unlock_irqsave(window_lock);
 }
 
@@ -19,9 +19,14 @@ typedef struct window {
     uint32_t y;
     uint32_t width;
     uint32_t height;
+    // The window's contents, through the kernel's mapping of physical memory
     uint32_t *buffer;
+    // The address that the owning process sees the window's contents at
+    uint32_t *user_buffer;
     uint32_t pid;
-    int page_index;
+    // The frames holding the window's contents
+    int32_t frame;
+    uint32_t num_frames;
     int need_update;
 
     // The information related to the last mouse event:
@@ -0,0 +1,86 @@
+#include "work_queue.h"
+#include "lib.h"
+#include "processes.h"
+
+// Interrupt handlers only note what has to be done and queue it here, and the worker thread does the
+//  rest as a kernel thread that the scheduler runs like any other process, so that interrupts are not
+//  held up by long running work such as drawing the screen or handling network packets
+// Work items are linked into the queue through their own next field, so queueing work never allocates
+
+// The first and last work items in the queue, which are only changed with interrupts disabled
+static work_t *work_head = NULL;
+static work_t *work_tail = NULL;
+
+// The worker thread sleeps here while there is no work
+static wait_queue_t worker_wait_queue = WAIT_QUEUE_EMPTY;
+
+/*
+ * The function that the worker thread runs, which runs queued work in the order that it was queued,
+ *  and sleeps whenever the queue is empty
+ *
+ * INPUTS: unused: the argument given to kthread_create
+ */
+static void worker_thread(void *unused) {
+	uint32_t flags;
+
+	while (1) {
+		cli_and_save(flags);
+		while (work_head == NULL) {
+			process_wait(&worker_wait_queue);
+			cli();
+		}
+
+		// Take the work off the queue before running it, so that it can be queued again while it runs
+		work_t *work = work_head;
+		work_head = work->next;
+		if (work_head == NULL)
+			work_tail = NULL;
+		work->next = NULL;
+		work->pending = 0;
+		restore_flags(flags);
+
+		work->fn(work->data);
+	}
+}
+
+/*
+ * Starts the kernel worker thread that runs queued work
+ * This must be called with interrupts disabled before the first process is started, since the
+ *  scheduler expects to be running on the kernel stack of a process once there is one
+ *
+ * OUTPUTS: 0 on success and -1 if the thread could not be created
+ */
+int32_t init_work_queue() {
+	return (kthread_create(worker_thread, NULL) < 0) ? -1 : 0;
+}
+
+/*
+ * Queues work to be run by the worker thread, which is switched to as soon as the current interrupt
+ *  returns if it has a higher priority than the process that was interrupted
+ * Can be called from interrupt handlers
+ *
+ * INPUTS: work: the work to queue, which must stay valid until it has run
+ * OUTPUTS: 0 if the work was queued and 1 if it was already waiting to run
+ */
+int32_t queue_work(work_t *work) {
+	uint32_t flags;
+	cli_and_save(flags);
+
+	if (work->pending) {
+		restore_flags(flags);
+		return 1;
+	}
+
+	work->pending = 1;
+	work->next = NULL;
+	if (work_tail == NULL)
+		work_head = work;
+	else
+		work_tail->next = work;
+	work_tail = work;
+
+	wake_up(&worker_wait_queue);
+
+	restore_flags(flags);
+	return 0;
+}
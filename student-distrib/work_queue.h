@@ -0,0 +1,28 @@
+#ifndef _WORK_QUEUE_H
+#define _WORK_QUEUE_H
+
+#include "types.h"
+
+// A piece of work that an interrupt handler hands off to the kernel worker thread, which runs it
+//  later with interrupts enabled instead of inside the interrupt
+// Each work item is queued at most once at a time, so an interrupt that arrives again before the work
+//  has started running does not queue it again (the work should handle everything that is pending)
+typedef struct work_t {
+	// The function that does the work, which is given data as its argument
+	void (*fn)(void *data);
+	void *data;
+	// 1 from when the work is queued until the worker starts running it
+	volatile uint8_t pending;
+	// The work queued after this one, or NULL if it is the last one
+	struct work_t *next;
+} work_t;
+
+// Initializer for a work item that is not queued
+#define WORK_INIT(fn, data) {(fn), (data), 0, NULL}
+
+// Starts the kernel worker thread that runs queued work
+int32_t init_work_queue();
+// Queues work to be run by the worker thread, unless it is already queued
+int32_t queue_work(work_t *work);
+
+#endif
@@ -18,6 +18,14 @@ int main ()
 	return 2;
     }
 
+    /* Write the file straight out of the file system if it can be mapped */
+    void *data;
+    if (-1 != (cnt = ece391_mmap (fd, &data))) {
+        if (-1 == ece391_write (1, data, cnt))
+            return 3;
+        return 0;
+    }
+
     while (0 != (cnt = ece391_read (fd, buf, 1024))) {
         if (-1 == cnt) {
 	    ece391_fdputs (1, (uint8_t*)"file read failed\n");
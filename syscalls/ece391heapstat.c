@@ -0,0 +1,63 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define BUFSIZE 1024
+// The number of samples to take if none is given in the arguments
+#define DEFAULT_SAMPLES 10
+// The RTC frequency used to wait between samples, and the number of RTC ticks per sample
+#define RTC_FREQ 2
+#define TICKS_PER_SAMPLE 2
+
+int main ()
+{
+    int32_t i, fd, rtc_fd, cnt, freq;
+    uint32_t samples = DEFAULT_SAMPLES;
+    uint8_t buf[BUFSIZE];
+
+    // The optional argument is the number of samples to take
+    if (0 == ece391_getargs(buf, BUFSIZE)) {
+        samples = 0;
+        for (i = 0; buf[i] >= '0' && buf[i] <= '9'; i++)
+            samples = samples * 10 + (buf[i] - '0');
+        if (buf[i] != '\0' || samples == 0) {
+            ece391_fdputs(1, (uint8_t*)"usage: heapstat [number of samples]\n");
+            return 3;
+        }
+    }
+
+    rtc_fd = ece391_open((uint8_t*)"rtc");
+    freq = RTC_FREQ;
+    if (-1 == rtc_fd || -1 == ece391_write(rtc_fd, &freq, 4)) {
+        ece391_fdputs(1, (uint8_t*)"could not open the RTC\n");
+        return 2;
+    }
+
+    while (samples-- > 0) {
+        // Reopen the file for every sample, since each open reads a fresh snapshot from the start
+        if (-1 == (fd = ece391_open((uint8_t*)"kheap"))) {
+            ece391_fdputs(1, (uint8_t*)"could not open the heap statistics file\n");
+            return 2;
+        }
+
+        ece391_fdputs(1, (uint8_t*)"---- kernel heap ----\n");
+        while (0 < (cnt = ece391_read(fd, buf, BUFSIZE)))
+            ece391_write(1, buf, cnt);
+        ece391_close(fd);
+
+        if (-1 == cnt) {
+            ece391_fdputs(1, (uint8_t*)"heap statistics read failed\n");
+            return 3;
+        }
+
+        // Wait until the next sample
+        if (samples > 0) {
+            for (i = 0; i < TICKS_PER_SAMPLE; i++)
+                ece391_read(rtc_fd, &freq, 4);
+        }
+    }
+
+    ece391_close(rtc_fd);
+    return 0;
+}
@@ -23,6 +23,12 @@ extern int32_t ece391_set_handler (int32_t signum, void* handler);
 extern int32_t ece391_sigreturn (void);
 extern int32_t ece391_allocate_window(int32_t fd, void *buf);
 extern int32_t ece391_update_window(int32_t id);
+extern int32_t ece391_fork(void);
+extern int32_t ece391_mmap(int32_t fd, void **addr);
+extern int32_t ece391_shm_create(int32_t key, uint32_t size, void **addr);
+extern int32_t ece391_shm_attach(int32_t key, void **addr);
+extern int32_t ece391_shm_detach(void *addr);
+extern int32_t ece391_nice(int32_t increment);
 
 
 enum signums {
@@ -13,5 +13,11 @@
 #define SYS_SIGRETURN  10
 #define SYS_ALLOCATE_WINDOW  11
 #define SYS_UPDATE_WINDOW  12
+#define SYS_FORK  13
+#define SYS_MMAP  14
+#define SYS_SHM_CREATE  15
+#define SYS_SHM_ATTACH  16
+#define SYS_SHM_DETACH  17
+#define SYS_NICE  18
 
 #endif /* ECE391SYSNUM_H */